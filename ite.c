@@ -5,14 +5,38 @@
 #include <ctype.h>
 #include <errno.h>
 #include <time.h>
+#include <limits.h>
 #include <windows.h>
-#include <conio.h>
 #include <io.h>
 #include <fcntl.h>
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define ITE_HAVE_SSE2 1
+#endif
+#ifdef ITE_HAVE_ZLIB
+#include <zlib.h>
+#endif
 #define PROMPT_MAX_LENGTH 4096
 #define ITE_VERSION "0.0.1"
 #define ITE_TAB_STOP 8
 #define ITE_QUIT_TIMES 3
+#define DIFF_CONTEXT 3
+#define FILTER_CHUNK_SIZE 65536
+#define PERF_BUCKETS 140
+#define SEARCH_HISTORY_MAX 16
+#define SEARCH_HISTORY_LENGTH 128
+#define LINE_INDEX_MAGIC "ITEIDX1"
+#define BRACKET_TYPES 3
+#define GZIP_CHUNK_SIZE 65536
+#define HEX_PAGE_SIZE 4096
+#define WORD_MIN_LENGTH 3
+#define WORD_MAX_LENGTH 64
+#define WORD_SPLICE_ROWS 256
+#define COMPLETION_MAX 16
+#define HEX_BYTES_PER_LINE 16
+#define ROW_POOL_CLASSES 9
+#define ROW_POOL_MIN_BLOCK 16
+#define ROW_POOL_ARENA_SIZE (1 << 20)
 #ifndef STDIN_FILENO
 #define STDIN_FILENO 0
 #endif
@@ -31,15 +55,93 @@ enum editorKey {
     END_KEY,
     PAGE_UP,
     PAGE_DOWN,
-    F2_KEY = 1010
+    F2_KEY = 1010,
+    SHIFT_ARROW_LEFT,
+    SHIFT_ARROW_RIGHT,
+    SHIFT_ARROW_UP,
+    SHIFT_ARROW_DOWN,
+    SHIFT_HOME_KEY,
+    SHIFT_END_KEY,
+    F3_KEY,
+    F4_KEY
 };
 typedef struct erow {
     int index;
     int size;
+    int capacity;
     int rendered_size;
+    int rendered_capacity;
+    unsigned int hash;
+    int hash_valid;
+    int has_multibyte;
+    int render_stale;
     char *characters;
     char *rendered_characters;
 } erow;
+struct bracketSummary {
+    int net;
+    int min;
+};
+struct bracketNode {
+    int left;
+    int right;
+    int size;
+    unsigned int priority;
+    struct bracketSummary row[BRACKET_TYPES];
+    struct bracketSummary sum[BRACKET_TYPES];
+};
+struct bracketTree {
+    struct bracketNode *nodes;
+    int capacity;
+    int count;
+    int free_list;
+    int root;
+    int valid;
+    unsigned int seed;
+};
+struct gzipState {
+    int enabled;
+    int level;
+};
+struct wordNode {
+    int parent;
+    int child;
+    int sibling;
+    int count;
+    int best;
+    unsigned char ch;
+};
+struct wordTrie {
+    struct wordNode *nodes;
+    int num_nodes;
+    int capacity;
+};
+struct wordIndexJob {
+    struct wordTrie trie;
+    const char *text;
+    size_t length;
+    HANDLE map;
+};
+struct wordIndex {
+    struct wordTrie trie;
+    HANDLE thread;
+    struct wordIndexJob *job;
+    char *log;
+    size_t log_length, log_capacity;
+    int stale;
+};
+struct foldRegion {
+    int header;
+    int last;
+};
+struct foldState {
+    int *span;
+    int *hidden;
+    int *span_tree;
+    int *hidden_tree;
+    int count;
+    int capacity;
+};
 struct editorConfig {
     int file_position_x;
     int file_position_y;
@@ -49,8 +151,12 @@ struct editorConfig {
     int screen_rows;
     int screen_columns;
     int number_of_rows;
+    int row_capacity;
     int dirty;
     erow *row;
+    int selection_active;
+    int selection_anchor_x;
+    int selection_anchor_y;
     char *filename;
     char status_message[80];
     time_t status_message_time;
@@ -65,13 +171,124 @@ struct editorConfig {
     int terminal_height;
     int screen_dirty;
     int cursor_moved;
+    unsigned long long file_size;
+    unsigned long long file_mtime;
+    HANDLE line_index_thread;
+    struct bracketTree brackets;
+    struct gzipState gzip;
+    struct wordIndex words;
+    struct foldState folds;
 } E;
+int gzip_level = 6;
+struct editorBufferList {
+    struct editorConfig *items;
+    int count;
+    int capacity;
+    int current;
+} buffers;
 void editorSetStatusMessage(const char *fmt, ...);
 void editorRefreshScreen();
 void editorQuit();
 void editorInsertChar(int c);
-char *editorPrompt(char *prompt, void (*callback)(char *, int));
+void editorProcessKey(int c);
+void editorRowInsertString(erow *row, int at, const char *s, size_t len);
+void editorRowDelRange(erow *row, int at, int len);
+void editorRowTruncate(erow *row, int at);
+struct searchHistory;
+char *editorPrompt(char *prompt, void (*callback)(char *, int), struct searchHistory *history);
 static DWORD orig_mode_in = 0, orig_mode_out = 0;
+static UINT orig_cp_in = 0, orig_cp_out = 0;
+enum perfTimer {
+    PERF_KEY,
+    PERF_UPDATE_ROW,
+    PERF_DRAW,
+    PERF_WRITE,
+    PERF_LATENCY,
+    PERF_TIMERS
+};
+static const char *perf_timer_names[PERF_TIMERS] = { "key", "update_row", "draw", "write", "key_to_frame" };
+struct perfStats {
+    int enabled;
+    int overlay;
+    char *dump_path;
+    double ns_per_tick;
+    LONGLONG key_time;
+    unsigned long long histogram[PERF_TIMERS][PERF_BUCKETS];
+    unsigned long long count[PERF_TIMERS];
+    unsigned long long max_ns[PERF_TIMERS];
+    unsigned long long allocations;
+    unsigned long long bytes_written;
+    unsigned long long frames;
+} perf;
+LONGLONG perfNow() {
+    LARGE_INTEGER now;
+    QueryPerformanceCounter(&now);
+    return now.QuadPart;
+}
+void perfEnable() {
+    if (perf.enabled) return;
+    LARGE_INTEGER frequency;
+    QueryPerformanceFrequency(&frequency);
+    perf.ns_per_tick = 1e9 / (double)frequency.QuadPart;
+    perf.enabled = 1;
+}
+LONGLONG perfBegin() {
+    return perf.enabled ? perfNow() : 0;
+}
+int perfBucket(unsigned long long ns) {
+    if (ns < 4) return (int)ns;
+    int octave = 63;
+    while (!(ns >> octave)) octave--;
+    int bucket = octave * 4 + (int)((ns >> (octave - 2)) & 3);
+    return bucket < PERF_BUCKETS ? bucket : PERF_BUCKETS - 1;
+}
+unsigned long long perfBucketValue(int bucket) {
+    if (bucket < 8) return bucket;
+    return (unsigned long long)(4 + bucket % 4) << (bucket / 4 - 2);
+}
+void perfRecord(int timer, LONGLONG start, LONGLONG end) {
+    unsigned long long ns = (unsigned long long)((end - start) * perf.ns_per_tick);
+    perf.histogram[timer][perfBucket(ns)]++;
+    perf.count[timer]++;
+    if (ns > perf.max_ns[timer]) perf.max_ns[timer] = ns;
+}
+void perfEnd(int timer, LONGLONG start) {
+    if (start) perfRecord(timer, start, perfNow());
+}
+unsigned long long perfPercentile(int timer, double q) {
+    unsigned long long target = (unsigned long long)(perf.count[timer] * q), seen = 0;
+    for (int b = 0; b < PERF_BUCKETS; b++) {
+        seen += perf.histogram[timer][b];
+        if (seen > target) return perfBucketValue(b);
+    }
+    return perf.max_ns[timer];
+}
+void perfFormat(char *buf, size_t size, unsigned long long ns) {
+    if (ns < 1000) snprintf(buf, size, "%lluns", ns);
+    else if (ns < 1000000) snprintf(buf, size, "%.1fus", ns / 1e3);
+    else if (ns < 1000000000) snprintf(buf, size, "%.1fms", ns / 1e6);
+    else snprintf(buf, size, "%.2fs", ns / 1e9);
+}
+void perfDump() {
+    if (!perf.dump_path) return;
+    FILE *fp = fopen(perf.dump_path, "w");
+    if (!fp) return;
+    fprintf(fp, "frames %llu\nallocations %llu\nbytes_written %llu\n", perf.frames, perf.allocations, perf.bytes_written);
+    for (int t = 0; t < PERF_TIMERS; t++) {
+        fprintf(fp, "\n%s count %llu p50 %lluns p90 %lluns p99 %lluns max %lluns\n", perf_timer_names[t], perf.count[t],
+                perfPercentile(t, 0.5), perfPercentile(t, 0.9), perfPercentile(t, 0.99), perf.max_ns[t]);
+        for (int b = 0; b < PERF_BUCKETS; b++) {
+            if (perf.histogram[t][b])
+                fprintf(fp, "  >= %lluns %llu\n", perfBucketValue(b), perf.histogram[t][b]);
+        }
+    }
+    fclose(fp);
+}
+void perfToggleOverlay() {
+    perf.overlay = !perf.overlay;
+    if (perf.overlay) perfEnable();
+    E.screen_dirty = 1;
+}
 void die(const char *s) {
     const char *clear = "\x1b[2J\x1b[H";
     _write(STDOUT_FILENO, clear, (unsigned int)strlen(clear));
@@ -79,40 +296,157 @@ void die(const char *s) {
     exit(1);
 }
 void *safeMalloc(size_t size) {
+    perf.allocations++;
     void *ptr = malloc(size);
     if (!ptr) die("Memory allocation failure");
     return ptr;
 }
+struct rowPool {
+    char *free_list[ROW_POOL_CLASSES];
+    char *arena;
+    size_t arena_left;
+} row_pool;
+int rowPoolClass(size_t size, size_t *block) {
+    int cls = 0;
+    *block = ROW_POOL_MIN_BLOCK;
+    while (*block < size && cls < ROW_POOL_CLASSES) {
+        *block <<= 1;
+        cls++;
+    }
+    return cls;
+}
+char *rowAlloc(size_t size, int *capacity) {
+    size_t block;
+    int cls = rowPoolClass(size, &block);
+    if (cls == ROW_POOL_CLASSES) {
+        *capacity = (int)size;
+        return safeMalloc(size);
+    }
+    perf.allocations++;
+    *capacity = (int)block;
+    char *p = row_pool.free_list[cls];
+    if (p) {
+        row_pool.free_list[cls] = *(char **)p;
+        return p;
+    }
+    if (row_pool.arena_left < block) {
+        row_pool.arena = safeMalloc(ROW_POOL_ARENA_SIZE);
+        row_pool.arena_left = ROW_POOL_ARENA_SIZE;
+    }
+    p = row_pool.arena;
+    row_pool.arena += block;
+    row_pool.arena_left -= block;
+    return p;
+}
+void rowFree(char *p, int capacity) {
+    if (!p) return;
+    size_t block;
+    int cls = rowPoolClass(capacity, &block);
+    if (cls == ROW_POOL_CLASSES) {
+        free(p);
+        return;
+    }
+    *(char **)p = row_pool.free_list[cls];
+    row_pool.free_list[cls] = p;
+}
 void disableRawMode() {
     _write(STDOUT_FILENO, "\x1b[?1049l", 8);
     SetConsoleMode(GetStdHandle(STD_INPUT_HANDLE), orig_mode_in);
     SetConsoleMode(GetStdHandle(STD_OUTPUT_HANDLE), orig_mode_out);
+    SetConsoleCP(orig_cp_in);
+    SetConsoleOutputCP(orig_cp_out);
 }
 void enableRawMode() {
     HANDLE hStdin = GetStdHandle(STD_INPUT_HANDLE);
     if (hStdin == INVALID_HANDLE_VALUE) die("GetStdHandle");
     if (!GetConsoleMode(hStdin, &orig_mode_in)) die("GetConsoleMode");
-    if (!SetConsoleMode(hStdin, orig_mode_in & ~(ENABLE_ECHO_INPUT | ENABLE_LINE_INPUT))) die("SetConsoleMode");
+    if (!SetConsoleMode(hStdin, orig_mode_in & ~(ENABLE_ECHO_INPUT | ENABLE_LINE_INPUT | ENABLE_PROCESSED_INPUT))) die("SetConsoleMode");
     HANDLE hStdout = GetStdHandle(STD_OUTPUT_HANDLE);
     if (hStdout == INVALID_HANDLE_VALUE) die("GetStdHandle");
     if (!GetConsoleMode(hStdout, &orig_mode_out)) die("GetConsoleMode");
     if (!SetConsoleMode(hStdout, orig_mode_out | ENABLE_VIRTUAL_TERMINAL_PROCESSING)) die("SetConsoleMode");
+    orig_cp_in = GetConsoleCP();
+    orig_cp_out = GetConsoleOutputCP();
+    SetConsoleCP(CP_UTF8);
+    SetConsoleOutputCP(CP_UTF8);
     atexit(disableRawMode);
     _write(STDOUT_FILENO, "\x1b[?1049h", 8);
 }
+struct macroState {
+    int *keys;
+    int count;
+    int capacity;
+    int recording;
+    int replaying;
+    int replay_position;
+} macro;
+int editorTranslateKey(KEY_EVENT_RECORD *key, unsigned char *bytes) {
+    static unsigned int high_surrogate = 0;
+    int shift = key->dwControlKeyState & SHIFT_PRESSED;
+    bytes[0] = 0;
+    switch (key->wVirtualKeyCode) {
+        case VK_UP: return shift ? SHIFT_ARROW_UP : ARROW_UP;
+        case VK_DOWN: return shift ? SHIFT_ARROW_DOWN : ARROW_DOWN;
+        case VK_LEFT: return shift ? SHIFT_ARROW_LEFT : ARROW_LEFT;
+        case VK_RIGHT: return shift ? SHIFT_ARROW_RIGHT : ARROW_RIGHT;
+        case VK_HOME: return shift ? SHIFT_HOME_KEY : HOME_KEY;
+        case VK_END: return shift ? SHIFT_END_KEY : END_KEY;
+        case VK_PRIOR: return PAGE_UP;
+        case VK_NEXT: return PAGE_DOWN;
+        case VK_DELETE: return DEL_KEY;
+        case VK_F2: return F2_KEY;
+        case VK_F3: return F3_KEY;
+        case VK_F4: return F4_KEY;
+    }
+    unsigned int cp = key->uChar.UnicodeChar;
+    if (cp == 0) return -1;
+    if (cp >= 0xD800 && cp < 0xDC00) {
+        high_surrogate = cp;
+        return -1;
+    }
+    if (cp >= 0xDC00 && cp < 0xE000) {
+        if (!high_surrogate) return -1;
+        cp = 0x10000 + ((high_surrogate - 0xD800) << 10) + (cp - 0xDC00);
+        high_surrogate = 0;
+    }
+    if (cp < 0x80) return (int)cp;
+    int n = cp < 0x800 ? 2 : cp < 0x10000 ? 3 : 4;
+    for (int i = n - 1; i > 0; i--, cp >>= 6) bytes[i - 1] = 0x80 | (cp & 0x3F);
+    bytes[n - 1] = 0;
+    return (int)(cp | (n == 2 ? 0xC0 : n == 3 ? 0xE0 : 0xF0));
+}
+int editorReadRawKey() {
+    static unsigned char pending[4];
+    static int pending_position = 0, repeat = 0;
+    static KEY_EVENT_RECORD last_key;
+    if (pending[pending_position]) return pending[pending_position++];
+    for (;;) {
+        if (repeat == 0) {
+            INPUT_RECORD record;
+            DWORD read;
+            if (!ReadConsoleInputW(GetStdHandle(STD_INPUT_HANDLE), &record, 1, &read)) die("ReadConsoleInputW");
+            if (read == 0 || record.EventType != KEY_EVENT || !record.Event.KeyEvent.bKeyDown) continue;
+            last_key = record.Event.KeyEvent;
+            repeat = last_key.wRepeatCount ? last_key.wRepeatCount : 1;
+        }
+        repeat--;
+        pending_position = 0;
+        int c = editorTranslateKey(&last_key, pending);
+        if (c >= 0) return c;
+    }
+}
 int editorReadKey() {
-    int c = _getch();
-    if (c == 0 || c == 224) {
-        c = _getch();
-        switch (c) {
-            case 72: return ARROW_UP;
-            case 80: return ARROW_DOWN;
-            case 75: return ARROW_LEFT;
-            case 77: return ARROW_RIGHT;
-            case 83: return DEL_KEY;
-            case 60: return F2_KEY;
-            default: return c;
+    if (macro.replaying)
+        return macro.replay_position < macro.count ? macro.keys[macro.replay_position++] : '\x1b';
+    int c = editorReadRawKey();
+    if (macro.recording) {
+        if (macro.count == macro.capacity) {
+            macro.capacity = macro.capacity ? macro.capacity * 2 : 64;
+            int *keys = realloc(macro.keys, sizeof(int) * macro.capacity);
+            if (!keys) die("Memory allocation failure in editorReadKey");
+            macro.keys = keys;
         }
+        macro.keys[macro.count++] = c;
     }
     return c;
 }
@@ -124,103 +458,870 @@ int getWindowSize(int *rows, int *cols) {
     *rows = csbi.srWindow.Bottom - csbi.srWindow.Top + 1;
     return 0;
 }
+struct widthRange {
+    unsigned int first;
+    unsigned int last;
+};
+static const struct widthRange zero_width_ranges[] = {
+    { 0x0300, 0x036F }, { 0x0483, 0x0489 }, { 0x0591, 0x05BD }, { 0x05BF, 0x05BF }, { 0x05C1, 0x05C2 },
+    { 0x05C4, 0x05C5 }, { 0x05C7, 0x05C7 }, { 0x0610, 0x061A }, { 0x064B, 0x065F }, { 0x0670, 0x0670 },
+    { 0x06D6, 0x06DC }, { 0x06DF, 0x06E4 }, { 0x06E7, 0x06E8 }, { 0x06EA, 0x06ED }, { 0x0711, 0x0711 },
+    { 0x0730, 0x074A }, { 0x07A6, 0x07B0 }, { 0x0816, 0x082D }, { 0x0900, 0x0902 }, { 0x093A, 0x093C },
+    { 0x0941, 0x0948 }, { 0x094D, 0x094D }, { 0x0951, 0x0957 }, { 0x0962, 0x0963 }, { 0x0E31, 0x0E31 },
+    { 0x0E34, 0x0E3A }, { 0x0E47, 0x0E4E }, { 0x1AB0, 0x1AFF }, { 0x1DC0, 0x1DFF }, { 0x200B, 0x200F },
+    { 0x202A, 0x202E }, { 0x2060, 0x2064 }, { 0x20D0, 0x20FF }, { 0xFE00, 0xFE0F }, { 0xFE20, 0xFE2F },
+    { 0xFEFF, 0xFEFF }, { 0xE0100, 0xE01EF }
+};
+static const struct widthRange wide_ranges[] = {
+    { 0x1100, 0x115F }, { 0x231A, 0x231B }, { 0x2329, 0x232A }, { 0x23E9, 0x23EC }, { 0x23F0, 0x23F0 },
+    { 0x23F3, 0x23F3 }, { 0x25FD, 0x25FE }, { 0x2614, 0x2615 }, { 0x2648, 0x2653 }, { 0x267F, 0x267F },
+    { 0x2693, 0x2693 }, { 0x26A1, 0x26A1 }, { 0x26AA, 0x26AB }, { 0x26BD, 0x26BE }, { 0x26C4, 0x26C5 },
+    { 0x26CE, 0x26CE }, { 0x26D4, 0x26D4 }, { 0x26EA, 0x26EA }, { 0x26F2, 0x26F3 }, { 0x26F5, 0x26F5 },
+    { 0x26FA, 0x26FA }, { 0x26FD, 0x26FD }, { 0x2705, 0x2705 }, { 0x270A, 0x270B }, { 0x2728, 0x2728 },
+    { 0x274C, 0x274C }, { 0x274E, 0x274E }, { 0x2753, 0x2755 }, { 0x2757, 0x2757 }, { 0x2795, 0x2797 },
+    { 0x27B0, 0x27B0 }, { 0x27BF, 0x27BF }, { 0x2B1B, 0x2B1C }, { 0x2B50, 0x2B50 }, { 0x2B55, 0x2B55 },
+    { 0x2E80, 0x303E }, { 0x3041, 0x33FF }, { 0x3400, 0x4DBF }, { 0x4E00, 0x9FFF }, { 0xA000, 0xA4CF },
+    { 0xA960, 0xA97F }, { 0xAC00, 0xD7A3 }, { 0xF900, 0xFAFF }, { 0xFE10, 0xFE19 }, { 0xFE30, 0xFE6F },
+    { 0xFF00, 0xFF60 }, { 0xFFE0, 0xFFE6 }, { 0x16FE0, 0x16FE4 }, { 0x17000, 0x18AFF }, { 0x1B000, 0x1B2FF },
+    { 0x1F004, 0x1F004 }, { 0x1F0CF, 0x1F0CF }, { 0x1F18E, 0x1F18E }, { 0x1F191, 0x1F19A }, { 0x1F200, 0x1F251 },
+    { 0x1F300, 0x1F64F }, { 0x1F680, 0x1F6FF }, { 0x1F900, 0x1F9FF }, { 0x1FA70, 0x1FAFF }, { 0x20000, 0x2FFFD },
+    { 0x30000, 0x3FFFD }
+};
+int widthRangeContains(const struct widthRange *table, int count, unsigned int cp) {
+    if (cp < table[0].first || cp > table[count - 1].last) return 0;
+    int lo = 0, hi = count - 1;
+    while (lo <= hi) {
+        int mid = (lo + hi) / 2;
+        if (cp > table[mid].last) lo = mid + 1;
+        else if (cp < table[mid].first) hi = mid - 1;
+        else return 1;
+    }
+    return 0;
+}
+int utf8CodepointWidth(unsigned int cp) {
+    if (cp < 0x300) return 1;
+    if (widthRangeContains(zero_width_ranges, sizeof(zero_width_ranges) / sizeof(zero_width_ranges[0]), cp)) return 0;
+    if (widthRangeContains(wide_ranges, sizeof(wide_ranges) / sizeof(wide_ranges[0]), cp)) return 2;
+    return 1;
+}
+int utf8Decode(const char *s, int len, unsigned int *cp) {
+    unsigned char c = (unsigned char)s[0];
+    int n = c < 0x80 ? 1 : (c & 0xE0) == 0xC0 ? 2 : (c & 0xF0) == 0xE0 ? 3 : (c & 0xF8) == 0xF0 ? 4 : 0;
+    if (n == 0 || n > len) {
+        *cp = 0xFFFD;
+        return 1;
+    }
+    unsigned int value = n == 1 ? c : c & (0x7F >> n);
+    for (int i = 1; i < n; i++) {
+        unsigned char cc = (unsigned char)s[i];
+        if ((cc & 0xC0) != 0x80) {
+            *cp = 0xFFFD;
+            return 1;
+        }
+        value = (value << 6) | (cc & 0x3F);
+    }
+    *cp = value;
+    return n;
+}
+int utf8IsAscii(const char *s, int len) {
+    int i = 0;
+#ifdef ITE_HAVE_SSE2
+    for (; i + 64 <= len; i += 64) {
+        __m128i v = _mm_or_si128(_mm_or_si128(_mm_loadu_si128((const __m128i *)(s + i)), _mm_loadu_si128((const __m128i *)(s + i + 16))),
+                                 _mm_or_si128(_mm_loadu_si128((const __m128i *)(s + i + 32)), _mm_loadu_si128((const __m128i *)(s + i + 48))));
+        if (_mm_movemask_epi8(v)) return 0;
+    }
+    for (; i + 16 <= len; i += 16) {
+        if (_mm_movemask_epi8(_mm_loadu_si128((const __m128i *)(s + i)))) return 0;
+    }
+#endif
+    for (; i < len; i++) {
+        if ((unsigned char)s[i] & 0x80) return 0;
+    }
+    return 1;
+}
+int editorRowNextCharStart(erow *row, int at) {
+    if (at >= row->size) return row->size;
+    if (!row->has_multibyte) return at + 1;
+    unsigned int cp;
+    at += utf8Decode(&row->characters[at], row->size - at, &cp);
+    while (at < row->size) {
+        int n = utf8Decode(&row->characters[at], row->size - at, &cp);
+        if (utf8CodepointWidth(cp) != 0) break;
+        at += n;
+    }
+    return at;
+}
+int editorRowPrevCharStart(erow *row, int at) {
+    if (at <= 0) return 0;
+    if (!row->has_multibyte) return at - 1;
+    unsigned int cp;
+    do {
+        at--;
+        while (at > 0 && ((unsigned char)row->characters[at] & 0xC0) == 0x80) at--;
+        utf8Decode(&row->characters[at], row->size - at, &cp);
+    } while (at > 0 && utf8CodepointWidth(cp) == 0);
+    return at;
+}
 int editorRowFilePositionXToScreenPositionX(erow *row, int file_x) {
     int screen_x = 0;
-    for (int j = 0; j < file_x; j++) {
-        if (row->characters[j] == '\t')
-            screen_x += (ITE_TAB_STOP - 1) - (screen_x % ITE_TAB_STOP);
-        screen_x++;
+    if (!row->has_multibyte) {
+        for (int j = 0; j < file_x; j++) {
+            if (row->characters[j] == '\t')
+                screen_x += (ITE_TAB_STOP - 1) - (screen_x % ITE_TAB_STOP);
+            screen_x++;
+        }
+        return screen_x;
+    }
+    if (file_x > row->size) file_x = row->size;
+    for (int j = 0; j < file_x; ) {
+        unsigned int cp;
+        int n = utf8Decode(&row->characters[j], row->size - j, &cp);
+        screen_x += cp == '\t' ? ITE_TAB_STOP - (screen_x % ITE_TAB_STOP) : utf8CodepointWidth(cp);
+        j += n;
     }
     return screen_x;
 }
 int editorRowScreenPositionXToFilePositionX(erow *row, int screen_x) {
     int cur = 0, file_x;
-    for (file_x = 0; file_x < row->size; file_x++) {
-        if (row->characters[file_x] == '\t')
-            cur += (ITE_TAB_STOP - 1) - (cur % ITE_TAB_STOP);
-        cur++;
+    if (!row->has_multibyte) {
+        for (file_x = 0; file_x < row->size; file_x++) {
+            if (row->characters[file_x] == '\t')
+                cur += (ITE_TAB_STOP - 1) - (cur % ITE_TAB_STOP);
+            cur++;
+            if (cur > screen_x) return file_x;
+        }
+        return file_x;
+    }
+    for (file_x = 0; file_x < row->size; ) {
+        unsigned int cp;
+        int n = utf8Decode(&row->characters[file_x], row->size - file_x, &cp);
+        cur += cp == '\t' ? ITE_TAB_STOP - (cur % ITE_TAB_STOP) : utf8CodepointWidth(cp);
         if (cur > screen_x) return file_x;
+        file_x += n;
     }
     return file_x;
 }
-void editorUpdateRow(erow *row) {
+int editorRenderedByteToColumn(erow *row, int byte) {
+    if (!row->has_multibyte) return byte;
+    int col = 0;
+    for (int j = 0; j < byte && j < row->rendered_size; ) {
+        unsigned int cp;
+        j += utf8Decode(&row->rendered_characters[j], row->rendered_size - j, &cp);
+        col += utf8CodepointWidth(cp);
+    }
+    return col;
+}
+void editorRenderedColumnsToBytes(erow *row, int col_start, int col_end, int *byte_start, int *byte_end) {
+    int col = 0, j = 0;
+    *byte_start = *byte_end = row->rendered_size;
+    while (j < row->rendered_size) {
+        unsigned int cp;
+        int n = utf8Decode(&row->rendered_characters[j], row->rendered_size - j, &cp);
+        int width = utf8CodepointWidth(cp);
+        if (col >= col_start && width > 0) break;
+        col += width;
+        j += n;
+    }
+    *byte_start = j;
+    while (j < row->rendered_size) {
+        unsigned int cp;
+        int n = utf8Decode(&row->rendered_characters[j], row->rendered_size - j, &cp);
+        int width = utf8CodepointWidth(cp);
+        if (col + width > col_end) break;
+        col += width;
+        j += n;
+    }
+    *byte_end = j;
+}
+void editorRenderRow(erow *row) {
+    LONGLONG perf_start = perfBegin();
     int screen_x = 0, j;
     for (j = 0; j < row->size; j++)
-        screen_x += row->characters[j] == '\t' ? ITE_TAB_STOP - (screen_x % ITE_TAB_STOP) : 1;
-    free(row->rendered_characters);
-    row->rendered_characters = safeMalloc(screen_x + 1);
+        screen_x += row->characters[j] != '\t' ? 1 : row->has_multibyte ? ITE_TAB_STOP : ITE_TAB_STOP - (screen_x % ITE_TAB_STOP);
+    if (screen_x + 1 > row->rendered_capacity) {
+        rowFree(row->rendered_characters, row->rendered_capacity);
+        row->rendered_characters = rowAlloc(screen_x + 1, &row->rendered_capacity);
+    }
     int idx = 0;
     screen_x = 0;
-    for (j = 0; j < row->size; j++) {
+    for (j = 0; j < row->size; ) {
         if (row->characters[j] == '\t') {
             int spaces = ITE_TAB_STOP - (screen_x % ITE_TAB_STOP);
             memset(row->rendered_characters + idx, ' ', spaces);
             idx += spaces;
             screen_x += spaces;
+            j++;
+        } else if (row->has_multibyte) {
+            unsigned int cp;
+            int n = utf8Decode(&row->characters[j], row->size - j, &cp);
+            memcpy(row->rendered_characters + idx, &row->characters[j], n);
+            idx += n;
+            screen_x += utf8CodepointWidth(cp);
+            j += n;
         } else {
-            row->rendered_characters[idx++] = row->characters[j];
+            row->rendered_characters[idx++] = row->characters[j++];
             screen_x++;
         }
     }
     row->rendered_characters[idx] = '\0';
     row->rendered_size = idx;
+    row->render_stale = 0;
+    perfEnd(PERF_UPDATE_ROW, perf_start);
 }
-void editorInsertRow(int at, char *s, size_t len) {
-    if (at < 0 || at > E.number_of_rows) return;
-    static int capacity = 0;
-    if (E.number_of_rows + 1 > capacity) {
-        capacity = capacity ? capacity * 2 : 16;
-        erow *new_rows = realloc(E.row, sizeof(erow) * capacity);
-        if (!new_rows) die("Memory allocation failure in editorInsertRow");
-        E.row = new_rows;
+static const char bracket_open[BRACKET_TYPES] = { '(', '[', '{' };
+static const char bracket_close[BRACKET_TYPES] = { ')', ']', '}' };
+void editorRowBracketSummary(erow *row, struct bracketSummary *summary) {
+    memset(summary, 0, sizeof(struct bracketSummary) * BRACKET_TYPES);
+    for (int j = 0; j < row->size; j++) {
+        for (int type = 0; type < BRACKET_TYPES; type++) {
+            if (row->characters[j] == bracket_open[type]) {
+                summary[type].net++;
+            } else if (row->characters[j] == bracket_close[type]) {
+                if (--summary[type].net < summary[type].min) summary[type].min = summary[type].net;
+            }
+        }
     }
-    if (at < E.number_of_rows)
-        memmove(&E.row[at + 1], &E.row[at], sizeof(erow) * (E.number_of_rows - at));
-    erow *row = &E.row[at];
+}
+void bracketCombine(struct bracketSummary *parent, const struct bracketSummary *left, const struct bracketSummary *right) {
+    int net = left->net + right->net;
+    parent->min = left->min < left->net + right->min ? left->min : left->net + right->min;
+    parent->net = net;
+}
+void bracketPull(struct bracketTree *tree, int t) {
+    struct bracketNode *n = &tree->nodes[t], *left = &tree->nodes[n->left], *right = &tree->nodes[n->right];
+    n->size = left->size + 1 + right->size;
+    for (int type = 0; type < BRACKET_TYPES; type++) {
+        bracketCombine(&n->sum[type], &left->sum[type], &n->row[type]);
+        bracketCombine(&n->sum[type], &n->sum[type], &right->sum[type]);
+    }
+}
+int bracketNewNode(struct bracketTree *tree, erow *row) {
+    int t = tree->free_list;
+    if (t) {
+        tree->free_list = tree->nodes[t].left;
+    } else {
+        if (tree->count == tree->capacity) {
+            int capacity = tree->capacity ? tree->capacity * 2 : 1024;
+            struct bracketNode *nodes = realloc(tree->nodes, sizeof(struct bracketNode) * capacity);
+            if (!nodes) die("Memory allocation failure in bracketNewNode");
+            if (!tree->capacity) memset(&nodes[0], 0, sizeof(struct bracketNode));
+            tree->nodes = nodes;
+            tree->capacity = capacity;
+            if (!tree->count) tree->count = 1;
+        }
+        t = tree->count++;
+    }
+    struct bracketNode *n = &tree->nodes[t];
+    tree->seed ^= tree->seed << 13;
+    tree->seed ^= tree->seed >> 17;
+    tree->seed ^= tree->seed << 5;
+    n->priority = tree->seed;
+    n->left = n->right = 0;
+    editorRowBracketSummary(row, n->row);
+    bracketPull(tree, t);
+    return t;
+}
+void bracketFreeNodes(struct bracketTree *tree, int t) {
+    if (!t) return;
+    bracketFreeNodes(tree, tree->nodes[t].right);
+    int left = tree->nodes[t].left;
+    tree->nodes[t].left = tree->free_list;
+    tree->free_list = t;
+    bracketFreeNodes(tree, left);
+}
+void bracketSplit(struct bracketTree *tree, int t, int k, int *first, int *rest) {
+    if (!t) {
+        *first = *rest = 0;
+        return;
+    }
+    struct bracketNode *n = &tree->nodes[t];
+    int left_size = tree->nodes[n->left].size;
+    if (k <= left_size) {
+        bracketSplit(tree, n->left, k, first, &n->left);
+        *rest = t;
+    } else {
+        bracketSplit(tree, n->right, k - left_size - 1, &n->right, rest);
+        *first = t;
+    }
+    bracketPull(tree, t);
+}
+int bracketMerge(struct bracketTree *tree, int a, int b) {
+    if (!a || !b) return a ? a : b;
+    if (tree->nodes[a].priority > tree->nodes[b].priority) {
+        tree->nodes[a].right = bracketMerge(tree, tree->nodes[a].right, b);
+        bracketPull(tree, a);
+        return a;
+    }
+    tree->nodes[b].left = bracketMerge(tree, a, tree->nodes[b].left);
+    bracketPull(tree, b);
+    return b;
+}
+int bracketBuildRange(struct bracketTree *tree, erow *rows, int count) {
+    int *stack = safeMalloc(sizeof(int) * (count + 1));
+    int top = 0;
+    for (int i = 0; i < count; i++) {
+        int t = bracketNewNode(tree, &rows[i]), last = 0;
+        while (top > 0 && tree->nodes[stack[top - 1]].priority < tree->nodes[t].priority) {
+            last = stack[--top];
+            bracketPull(tree, last);
+        }
+        tree->nodes[t].left = last;
+        if (top > 0) tree->nodes[stack[top - 1]].right = t;
+        stack[top++] = t;
+    }
+    while (top > 1) bracketPull(tree, stack[--top]);
+    int root = top ? stack[0] : 0;
+    if (root) bracketPull(tree, root);
+    free(stack);
+    return root;
+}
+void bracketTreeSet(struct bracketTree *tree, int t, int k, erow *row) {
+    struct bracketNode *n = &tree->nodes[t];
+    int left_size = tree->nodes[n->left].size;
+    if (k < left_size) bracketTreeSet(tree, n->left, k, row);
+    else if (k > left_size) bracketTreeSet(tree, n->right, k - left_size - 1, row);
+    else editorRowBracketSummary(row, n->row);
+    bracketPull(tree, t);
+}
+int editorRowInBuffer(erow *row) {
+    return row->index >= 0 && row->index < E.number_of_rows && &E.row[row->index] == row;
+}
+void bracketTreeUpdate(erow *row) {
+    if (E.brackets.valid) bracketTreeSet(&E.brackets, E.brackets.root, row->index, row);
+}
+void bracketRowsInserted(int at, int count) {
+    struct bracketTree *tree = &E.brackets;
+    if (!tree->valid) return;
+    int first, rest;
+    bracketSplit(tree, tree->root, at, &first, &rest);
+    int inserted = bracketBuildRange(tree, &E.row[at], count);
+    tree->root = bracketMerge(tree, bracketMerge(tree, first, inserted), rest);
+}
+void bracketRowsRemoved(int at, int count) {
+    struct bracketTree *tree = &E.brackets;
+    if (!tree->valid) return;
+    int first, middle, rest;
+    bracketSplit(tree, tree->root, at, &first, &rest);
+    bracketSplit(tree, rest, count, &middle, &rest);
+    bracketFreeNodes(tree, middle);
+    tree->root = bracketMerge(tree, first, rest);
+}
+void bracketTreesInvalidate() {
+    E.brackets.valid = 0;
+    E.brackets.root = E.brackets.free_list = 0;
+    if (E.brackets.count) E.brackets.count = 1;
+}
+int wordChar(char c) {
+    return isalnum((unsigned char)c) || c == '_' || (unsigned char)c >= 0x80;
+}
+int wordNext(const char *s, size_t len, size_t *pos, size_t *start) {
+    while (*pos < len) {
+        while (*pos < len && !wordChar(s[*pos])) (*pos)++;
+        *start = *pos;
+        while (*pos < len && wordChar(s[*pos])) (*pos)++;
+        size_t length = *pos - *start;
+        if (length >= WORD_MIN_LENGTH && length <= WORD_MAX_LENGTH && !isdigit((unsigned char)s[*start])) return (int)length;
+    }
+    return 0;
+}
+int wordTrieChild(struct wordTrie *trie, int node, unsigned char ch, int create) {
+    int child;
+    for (child = trie->nodes[node].child; child; child = trie->nodes[child].sibling) {
+        if (trie->nodes[child].ch == ch) return child;
+    }
+    if (!create) return 0;
+    if (trie->num_nodes == trie->capacity) {
+        trie->capacity *= 2;
+        struct wordNode *grown = realloc(trie->nodes, sizeof(struct wordNode) * trie->capacity);
+        if (!grown) die("Memory allocation failure in wordTrieChild");
+        trie->nodes = grown;
+    }
+    child = trie->num_nodes++;
+    struct wordNode *n = &trie->nodes[child];
+    n->parent = node;
+    n->sibling = trie->nodes[node].child;
+    n->child = 0;
+    n->count = 0;
+    n->best = 0;
+    n->ch = ch;
+    trie->nodes[node].child = child;
+    return child;
+}
+void wordTrieAdd(struct wordTrie *trie, const char *s, int len, int delta, int maintain) {
+    if (!trie->nodes) {
+        trie->capacity = 1024;
+        trie->nodes = malloc(sizeof(struct wordNode) * trie->capacity);
+        if (!trie->nodes) die("Memory allocation failure in wordTrieAdd");
+        memset(&trie->nodes[0], 0, sizeof(struct wordNode));
+        trie->num_nodes = 1;
+    }
+    int node = 0;
+    for (int i = 0; i < len; i++) {
+        node = wordTrieChild(trie, node, (unsigned char)s[i], delta > 0);
+        if (!node) return;
+    }
+    trie->nodes[node].count += delta;
+    if (trie->nodes[node].count < 0) trie->nodes[node].count = 0;
+    if (!maintain) return;
+    for (; node >= 0; node = node ? trie->nodes[node].parent : -1) {
+        int best = trie->nodes[node].count;
+        for (int child = trie->nodes[node].child; child; child = trie->nodes[child].sibling) {
+            if (trie->nodes[child].best > best) best = trie->nodes[child].best;
+        }
+        if (best == trie->nodes[node].best) break;
+        trie->nodes[node].best = best;
+    }
+}
+void wordTrieFinish(struct wordTrie *trie) {
+    for (int node = trie->num_nodes - 1; node > 0; node--) {
+        struct wordNode *n = &trie->nodes[node];
+        if (n->count > n->best) n->best = n->count;
+        if (n->best > trie->nodes[n->parent].best) trie->nodes[n->parent].best = n->best;
+    }
+}
+DWORD WINAPI editorWordIndexBuilder(LPVOID arg) {
+    struct wordIndexJob *job = arg;
+    size_t pos = 0, start;
+    int len;
+    while ((len = wordNext(job->text, job->length, &pos, &start)))
+        wordTrieAdd(&job->trie, job->text + start, len, 1, 0);
+    wordTrieFinish(&job->trie);
+    if (job->map) {
+        UnmapViewOfFile(job->text);
+        CloseHandle(job->map);
+    } else {
+        free((char *)job->text);
+    }
+    return 0;
+}
+void editorBuildWordIndex(const char *text, size_t length, HANDLE map) {
+    struct wordIndexJob *job = safeMalloc(sizeof(*job));
+    memset(&job->trie, 0, sizeof(job->trie));
+    job->text = text;
+    job->length = length;
+    job->map = map;
+    E.words.job = job;
+    E.words.thread = CreateThread(NULL, 0, editorWordIndexBuilder, job, 0, NULL);
+    if (!E.words.thread) {
+        editorWordIndexBuilder(job);
+        E.words.trie = job->trie;
+        E.words.job = NULL;
+        free(job);
+    }
+}
+int editorWordIndexReady(struct editorConfig *b, int wait) {
+    struct wordIndex *index = &b->words;
+    if (!index->thread) return 1;
+    if (WaitForSingleObject(index->thread, wait ? INFINITE : 0) != WAIT_OBJECT_0) return 0;
+    CloseHandle(index->thread);
+    index->thread = NULL;
+    free(index->trie.nodes);
+    index->trie = index->job->trie;
+    free(index->job);
+    index->job = NULL;
+    for (size_t pos = 0; pos < index->log_length;) {
+        signed char delta = index->log[pos];
+        unsigned char len = index->log[pos + 1];
+        wordTrieAdd(&index->trie, index->log + pos + 2, len, delta, 1);
+        pos += 2 + len;
+    }
+    free(index->log);
+    index->log = NULL;
+    index->log_length = index->log_capacity = 0;
+    return 1;
+}
+void wordIndexAdd(const char *s, int len, int delta) {
+    struct wordIndex *index = &E.words;
+    if (index->stale) return;
+    if (editorWordIndexReady(&E, 0)) {
+        wordTrieAdd(&index->trie, s, len, delta, 1);
+        return;
+    }
+    if (index->log_length + len + 2 > index->log_capacity) {
+        index->log_capacity = index->log_capacity ? index->log_capacity * 2 : 4096;
+        while (index->log_length + len + 2 > index->log_capacity) index->log_capacity *= 2;
+        index->log = realloc(index->log, index->log_capacity);
+        if (!index->log) die("Memory allocation failure in wordIndexAdd");
+    }
+    index->log[index->log_length++] = (char)delta;
+    index->log[index->log_length++] = (char)len;
+    memcpy(index->log + index->log_length, s, len);
+    index->log_length += len;
+}
+void wordIndexScan(const char *s, size_t length, int delta) {
+    size_t pos = 0, start;
+    int len;
+    while ((len = wordNext(s, length, &pos, &start)))
+        wordIndexAdd(s + start, len, delta);
+}
+void wordIndexRegion(erow *row, int from, int to, int delta) {
+    if (!editorRowInBuffer(row)) return;
+    while (from > 0 && wordChar(row->characters[from - 1])) from--;
+    while (to < row->size && wordChar(row->characters[to])) to++;
+    wordIndexScan(row->characters + from, to - from, delta);
+}
+void wordIndexRows(int at, int count, int delta) {
+    if (count > WORD_SPLICE_ROWS) {
+        E.words.stale = 1;
+        return;
+    }
+    for (int j = at; j < at + count; j++)
+        wordIndexScan(E.row[j].characters, E.row[j].size, delta);
+}
+void editorRebuildWordIndex() {
+    size_t length = 0;
+    for (int j = 0; j < E.number_of_rows; j++)
+        length += (size_t)E.row[j].size + 1;
+    char *text = safeMalloc(length ? length : 1), *p = text;
+    for (int j = 0; j < E.number_of_rows; j++) {
+        memcpy(p, E.row[j].characters, E.row[j].size);
+        p += E.row[j].size;
+        *p++ = '\n';
+    }
+    free(E.words.trie.nodes);
+    memset(&E.words.trie, 0, sizeof(E.words.trie));
+    E.words.stale = 0;
+    editorBuildWordIndex(text, length, NULL);
+}
+void editorFreeWordIndex() {
+    editorWordIndexReady(&E, 1);
+    free(E.words.trie.nodes);
+    memset(&E.words, 0, sizeof(E.words));
+}
+int wordIndexComplete(const char *prefix, int len, char words[][WORD_MAX_LENGTH + 1], int max) {
+    if (!editorWordIndexReady(&E, 0)) return -1;
+    if (E.words.stale) {
+        editorRebuildWordIndex();
+        if (!editorWordIndexReady(&E, 0)) return -1;
+    }
+    struct wordTrie *trie = &E.words.trie;
+    if (!trie->nodes) return 0;
+    int root = 0;
+    for (int i = 0; i < len; i++) {
+        root = wordTrieChild(trie, root, (unsigned char)prefix[i], 0);
+        if (!root) return 0;
+    }
+    int count = 0, pending = 1, capacity = 64;
+    int *frontier = safeMalloc(sizeof(int) * capacity);
+    frontier[0] = root * 2;
+    while (count < max && pending) {
+        int pick = 0;
+        for (int i = 1; i < pending; i++) {
+            struct wordNode *a = &trie->nodes[frontier[i] / 2], *b = &trie->nodes[frontier[pick] / 2];
+            if ((frontier[i] & 1 ? a->count : a->best) > (frontier[pick] & 1 ? b->count : b->best)) pick = i;
+        }
+        int entry = frontier[pick], node = entry / 2;
+        frontier[pick] = frontier[--pending];
+        if (entry & 1) {
+            char reversed[WORD_MAX_LENGTH];
+            int n = 0;
+            for (int at = node; at; at = trie->nodes[at].parent)
+                reversed[n++] = trie->nodes[at].ch;
+            for (int i = 0; i < n; i++)
+                words[count][i] = reversed[n - 1 - i];
+            words[count++][n] = '\0';
+            continue;
+        }
+        int children = 1;
+        for (int child = trie->nodes[node].child; child; child = trie->nodes[child].sibling) children++;
+        if (pending + children > capacity) {
+            while (pending + children > capacity) capacity *= 2;
+            frontier = realloc(frontier, sizeof(int) * capacity);
+            if (!frontier) die("Memory allocation failure in wordIndexComplete");
+        }
+        if (trie->nodes[node].count > 0 && node != root) frontier[pending++] = node * 2 + 1;
+        for (int child = trie->nodes[node].child; child; child = trie->nodes[child].sibling) {
+            if (trie->nodes[child].best > 0) frontier[pending++] = child * 2;
+        }
+    }
+    free(frontier);
+    return count;
+}
+int foldSearch(int target, int visible, int *span_before, int *hidden_before) {
+    struct foldState *folds = &E.folds;
+    int pos = 0, span = 0, hidden = 0, step = 1;
+    while (step * 2 <= folds->count) step *= 2;
+    for (; step; step /= 2) {
+        int next = pos + step;
+        if (next > folds->count) continue;
+        int value = folds->span_tree[next] - (visible ? folds->hidden_tree[next] : 0);
+        if (value < target) {
+            pos = next;
+            target -= value;
+            span += folds->span_tree[next];
+            hidden += folds->hidden_tree[next];
+        }
+    }
+    if (span_before) *span_before = span;
+    if (hidden_before) *hidden_before = hidden;
+    return pos;
+}
+int foldHeader(int index, int span_before) {
+    return span_before + E.folds.span[index] - 1 - E.folds.hidden[index];
+}
+void foldTreeAdd(int *tree, int index, int delta) {
+    for (index++; index <= E.folds.count; index += index & -index) tree[index] += delta;
+}
+void foldResize(int index, int span, int hidden) {
+    E.folds.span[index] += span;
+    E.folds.hidden[index] += hidden;
+    foldTreeAdd(E.folds.span_tree, index, span);
+    if (hidden) foldTreeAdd(E.folds.hidden_tree, index, hidden);
+}
+struct foldRegion *foldRegions() {
+    struct foldState *folds = &E.folds;
+    struct foldRegion *regions = safeMalloc(sizeof(struct foldRegion) * (folds->count + 1));
+    int last = -1;
+    for (int i = 0; i < folds->count; i++) {
+        last += folds->span[i];
+        regions[i].header = last - folds->hidden[i];
+        regions[i].last = last;
+    }
+    return regions;
+}
+void foldRebuild(struct foldRegion *regions, int count) {
+    struct foldState *folds = &E.folds;
+    if (count + 1 > folds->capacity) {
+        folds->capacity = (count + 1) * 2;
+        int **arrays[] = { &folds->span, &folds->hidden, &folds->span_tree, &folds->hidden_tree };
+        for (int k = 0; k < 4; k++) {
+            int *grown = realloc(*arrays[k], sizeof(int) * folds->capacity);
+            if (!grown) die("Memory allocation failure in foldRebuild");
+            *arrays[k] = grown;
+        }
+    }
+    int last = -1;
+    for (int i = 0; i < count; i++) {
+        folds->span[i] = folds->span_tree[i + 1] = regions[i].last - last;
+        folds->hidden[i] = folds->hidden_tree[i + 1] = regions[i].last - regions[i].header;
+        last = regions[i].last;
+    }
+    for (int i = 1; i <= count; i++) {
+        int parent = i + (i & -i);
+        if (parent > count) continue;
+        folds->span_tree[parent] += folds->span_tree[i];
+        folds->hidden_tree[parent] += folds->hidden_tree[i];
+    }
+    folds->count = count;
+    free(regions);
+}
+int foldFind(int header, int *insert_at) {
+    if (!E.folds.count) {
+        if (insert_at) *insert_at = 0;
+        return -1;
+    }
+    int span, index = foldSearch(header + 1, 0, &span, NULL);
+    if (insert_at) *insert_at = index;
+    return index < E.folds.count && foldHeader(index, span) == header ? index : -1;
+}
+int foldVisibleBefore(int row) {
+    if (!E.folds.count) return row;
+    int span, hidden, index = foldSearch(row + 1, 0, &span, &hidden);
+    if (index < E.folds.count) {
+        int header = foldHeader(index, span);
+        if (header < row) hidden += row - header - 1;
+    }
+    return row - hidden;
+}
+int foldRowAtVisible(int line) {
+    if (!E.folds.count) return line;
+    int hidden;
+    foldSearch(line + 1, 1, NULL, &hidden);
+    return line + hidden;
+}
+int foldHidden(int row) {
+    if (!E.folds.count || row < 0 || row >= E.number_of_rows) return 0;
+    int span, index = foldSearch(row + 1, 0, &span, NULL);
+    return index < E.folds.count && foldHeader(index, span) < row;
+}
+int foldNextRow(int row) {
+    if (!E.folds.count || row + 1 >= E.number_of_rows) return row + 1;
+    return foldRowAtVisible(foldVisibleBefore(row + 1));
+}
+int foldPrevRow(int row) {
+    if (!E.folds.count || row <= 0) return row - 1;
+    int line = foldVisibleBefore(row) - 1;
+    return line < 0 ? -1 : foldRowAtVisible(line);
+}
+int foldHiddenBelow(int row) {
+    int index = foldFind(row, NULL);
+    return index < 0 ? 0 : E.folds.hidden[index];
+}
+void foldAdd(int header, int last) {
+    int at;
+    if (foldFind(header, &at) >= 0) return;
+    struct foldRegion *regions = foldRegions();
+    int next = at;
+    for (; next < E.folds.count && regions[next].header <= last; next++) {
+        if (regions[next].last > last) last = regions[next].last;
+    }
+    memmove(&regions[at + 1], &regions[next], sizeof(struct foldRegion) * (E.folds.count - next));
+    regions[at].header = header;
+    regions[at].last = last;
+    foldRebuild(regions, E.folds.count - (next - at) + 1);
+}
+void foldRemove(int index) {
+    struct foldRegion *regions = foldRegions();
+    memmove(&regions[index], &regions[index + 1], sizeof(struct foldRegion) * (E.folds.count - index - 1));
+    foldRebuild(regions, E.folds.count - 1);
+}
+void foldReveal(int row) {
+    if (!foldHidden(row)) return;
+    foldRemove(foldSearch(row + 1, 0, NULL, NULL));
+}
+void foldRowsInserted(int at, int count) {
+    if (!E.folds.count) return;
+    int span, index = foldSearch(at + 1, 0, &span, NULL);
+    if (index == E.folds.count) return;
+    int header = foldHeader(index, span);
+    if (at == header + 1) {
+        foldRemove(index);
+        foldRowsInserted(at, count);
+        return;
+    }
+    foldResize(index, count, at > header ? count : 0);
+}
+void foldRowsRemoved(int at, int count) {
+    struct foldState *folds = &E.folds;
+    if (!folds->count) return;
+    int span, end = at + count - 1, index = foldSearch(at + 1, 0, &span, NULL);
+    if (index == folds->count) return;
+    int header = foldHeader(index, span), last = header + folds->hidden[index];
+    if (end < header) {
+        foldResize(index, -count, 0);
+        return;
+    }
+    if (header < at && end <= last) {
+        if (folds->hidden[index] == count) {
+            foldRemove(index);
+            foldRowsRemoved(at, count);
+        } else {
+            foldResize(index, -count, -count);
+        }
+        return;
+    }
+    struct foldRegion *regions = foldRegions();
+    int kept = 0;
+    for (int i = 0; i < folds->count; i++) {
+        struct foldRegion region = regions[i];
+        if (region.header > end) {
+            region.header -= count;
+            region.last -= count;
+        } else if (region.last >= at) {
+            continue;
+        }
+        regions[kept++] = region;
+    }
+    foldRebuild(regions, kept);
+}
+void editorUpdateRow(erow *row) {
+    row->has_multibyte = !utf8IsAscii(row->characters, row->size);
+    row->hash_valid = 0;
+    if (editorRowInBuffer(row)) bracketTreeUpdate(row);
+    if (macro.replaying) {
+        row->render_stale = 1;
+        return;
+    }
+    editorRenderRow(row);
+}
+void editorFlushStaleRows() {
+    for (int j = 0; j < E.number_of_rows; j++) {
+        if (E.row[j].render_stale) editorRenderRow(&E.row[j]);
+    }
+}
+void editorReserveRows(int count) {
+    if (count <= E.row_capacity) return;
+    int capacity = E.row_capacity ? E.row_capacity : 16;
+    while (capacity < count) capacity *= 2;
+    erow *new_rows = realloc(E.row, sizeof(erow) * capacity);
+    if (!new_rows) die("Memory allocation failure in editorReserveRows");
+    E.row = new_rows;
+    E.row_capacity = capacity;
+}
+void editorInitRow(erow *row, int at, const char *s, size_t len) {
     row->index = at;
-    row->size = len;
-    row->characters = malloc(len + 1);
-    if (!row->characters) die("Memory allocation failure in editorInsertRow");
+    row->size = (int)len;
+    row->characters = rowAlloc(len + 1, &row->capacity);
     memcpy(row->characters, s, len);
     row->characters[len] = '\0';
     row->rendered_characters = NULL;
     row->rendered_size = 0;
+    row->rendered_capacity = 0;
     editorUpdateRow(row);
-    E.number_of_rows++;
-    E.dirty++;
 }
 void editorFreeRow(erow *row) {
-    free(row->rendered_characters);
-    free(row->characters);
+    rowFree(row->rendered_characters, row->rendered_capacity);
+    rowFree(row->characters, row->capacity);
 }
-void editorDelRow(int at) {
-    if (at < 0 || at >= E.number_of_rows) return;
-    editorFreeRow(&E.row[at]);
-    memmove(&E.row[at], &E.row[at + 1], sizeof(erow) * (E.number_of_rows - at - 1));
-    for (int j = at; j < E.number_of_rows - 1; j++)
-        E.row[j].index--;
-    E.number_of_rows--;
+void editorRowReserve(erow *row, size_t size) {
+    if (size + 1 <= (size_t)row->capacity) return;
+    size_t wanted = (size_t)row->capacity * 2;
+    if (wanted < size + 1) wanted = size + 1;
+    int capacity;
+    char *new_chars = rowAlloc(wanted, &capacity);
+    memcpy(new_chars, row->characters, row->size + 1);
+    rowFree(row->characters, row->capacity);
+    row->characters = new_chars;
+    row->capacity = capacity;
+}
+void editorInsertRows(int at, erow *rows, int count) {
+    if (at < 0 || at > E.number_of_rows || count <= 0) return;
+    editorReserveRows(E.number_of_rows + count);
+    if (at < E.number_of_rows)
+        memmove(&E.row[at + count], &E.row[at], sizeof(erow) * (E.number_of_rows - at));
+    memcpy(&E.row[at], rows, sizeof(erow) * count);
+    E.number_of_rows += count;
+    wordIndexRows(at, count, 1);
+    bracketRowsInserted(at, count);
+    foldRowsInserted(at, count);
+    for (int j = at; j < E.number_of_rows; j++)
+        E.row[j].index = j;
+    E.dirty++;
+}
+void editorRemoveRows(int at, int count, erow *removed) {
+    if (at < 0 || count <= 0 || at + count > E.number_of_rows) return;
+    wordIndexRows(at, count, -1);
+    if (removed) {
+        memcpy(removed, &E.row[at], sizeof(erow) * count);
+    } else {
+        for (int j = at; j < at + count; j++)
+            editorFreeRow(&E.row[j]);
+    }
+    memmove(&E.row[at], &E.row[at + count], sizeof(erow) * (E.number_of_rows - at - count));
+    E.number_of_rows -= count;
+    bracketRowsRemoved(at, count);
+    foldRowsRemoved(at, count);
+    for (int j = at; j < E.number_of_rows; j++)
+        E.row[j].index = j;
     E.dirty++;
 }
+void editorInsertRow(int at, char *s, size_t len) {
+    if (at < 0 || at > E.number_of_rows) return;
+    erow row;
+    editorInitRow(&row, at, s, len);
+    editorInsertRows(at, &row, 1);
+}
+void editorDelRow(int at) {
+    editorRemoveRows(at, 1, NULL);
+}
 void editorRowInsertChar(erow *row, int at, int c) {
     if (at < 0 || at > row->size) at = row->size;
-    static int capacity = 0;
-    if (row->size + 2 > capacity) {
-        capacity = capacity ? capacity * 2 : 16;
-        char *new_chars = realloc(row->characters, capacity);
-        if (!new_chars) die("Memory allocation failure in editorRowInsertChar");
-        row->characters = new_chars;
-    }
+    wordIndexRegion(row, at, at, -1);
+    editorRowReserve(row, row->size + 1);
     memmove(&row->characters[at + 1], &row->characters[at], row->size - at + 1);
     row->size++;
     row->characters[at] = c;
+    wordIndexRegion(row, at, at + 1, 1);
     editorUpdateRow(row);
     E.dirty++;
 }
 void editorRowDelChar(erow *row, int at) {
     if (at < 0 || at >= row->size) return;
+    wordIndexRegion(row, at, at + 1, -1);
     memmove(&row->characters[at], &row->characters[at + 1], row->size - at);
     row->size--;
+    wordIndexRegion(row, at, at, 1);
     editorUpdateRow(row);
     E.dirty++;
 }
@@ -265,13 +1366,57 @@ void editorInsertChar(int c) {
     editorRowInsertChar(&E.row[E.file_position_y], E.file_position_x, c);
     E.file_position_x++;
 }
+struct completionState {
+    int active;
+    int row;
+    int at;
+    int prefix_length;
+    int length;
+    int count;
+    int current;
+    char words[COMPLETION_MAX][WORD_MAX_LENGTH + 1];
+} completion;
+void editorComplete() {
+    if (E.file_position_y >= E.number_of_rows) return;
+    erow *row = &E.row[E.file_position_y];
+    if (!completion.active || completion.row != E.file_position_y || completion.at + completion.length != E.file_position_x) {
+        int start = E.file_position_x;
+        while (start > 0 && wordChar(row->characters[start - 1])) start--;
+        completion.prefix_length = E.file_position_x - start;
+        completion.count = completion.prefix_length ?
+            wordIndexComplete(&row->characters[start], completion.prefix_length, completion.words, COMPLETION_MAX) : 0;
+        if (completion.count < 0) {
+            completion.active = 0;
+            editorSetStatusMessage("Word index building...");
+            return;
+        }
+        if (!completion.count) {
+            completion.active = 0;
+            editorSetStatusMessage("No completions");
+            return;
+        }
+        completion.active = 1;
+        completion.row = E.file_position_y;
+        completion.at = E.file_position_x;
+        completion.length = 0;
+        completion.current = -1;
+    }
+    completion.current = (completion.current + 1) % completion.count;
+    const char *suffix = completion.words[completion.current] + completion.prefix_length;
+    editorRowDelRange(row, completion.at, completion.length);
+    completion.length = (int)strlen(suffix);
+    editorRowInsertString(row, completion.at, suffix, completion.length);
+    E.file_position_x = completion.at + completion.length;
+    editorSetStatusMessage("Completion %d/%d: %s", completion.current + 1, completion.count, completion.words[completion.current]);
+}
 void editorRowAppendString(erow *row, char *s, size_t len) {
-    char *new_chars = realloc(row->characters, row->size + len + 1);
-    if (!new_chars) die("Memory allocation failure in editorRowAppendString");
-    row->characters = new_chars;
+    int at = row->size;
+    wordIndexRegion(row, at, at, -1);
+    editorRowReserve(row, row->size + len);
     memcpy(&row->characters[row->size], s, len);
     row->size += (int)len;
     row->characters[row->size] = '\0';
+    wordIndexRegion(row, at, row->size, 1);
     editorUpdateRow(row);
     E.dirty++;
 }
@@ -281,10 +1426,7 @@ void editorInsertNewline() {
     } else {
         erow *row = &E.row[E.file_position_y];
         editorInsertRow(E.file_position_y + 1, &row->characters[E.file_position_x], row->size - E.file_position_x);
-        row = &E.row[E.file_position_y];
-        row->size = E.file_position_x;
-        row->characters[row->size] = '\0';
-        editorUpdateRow(row);
+        editorRowTruncate(&E.row[E.file_position_y], E.file_position_x);
     }
     E.file_position_y++;
     E.file_position_x = 0;
@@ -294,8 +1436,10 @@ void editorDelChar() {
     if (E.file_position_x == 0 && E.file_position_y == 0) return;
     erow *row = &E.row[E.file_position_y];
     if (E.file_position_x > 0) {
-        editorRowDelChar(row, E.file_position_x - 1);
-        E.file_position_x--;
+        int prev = editorRowPrevCharStart(row, E.file_position_x);
+        if (E.file_position_x - prev == 1) editorRowDelChar(row, prev);
+        else editorRowDelRange(row, prev, E.file_position_x - prev);
+        E.file_position_x = prev;
     } else {
         E.file_position_x = E.row[E.file_position_y - 1].size;
         editorRowAppendString(&E.row[E.file_position_y - 1], row->characters, row->size);
@@ -303,6 +1447,204 @@ void editorDelChar() {
         E.file_position_y--;
     }
 }
+void editorRowInsertString(erow *row, int at, const char *s, size_t len) {
+    if (at < 0 || at > row->size) at = row->size;
+    wordIndexRegion(row, at, at, -1);
+    editorRowReserve(row, row->size + len);
+    memmove(&row->characters[at + len], &row->characters[at], row->size - at + 1);
+    memcpy(&row->characters[at], s, len);
+    row->size += (int)len;
+    wordIndexRegion(row, at, at + (int)len, 1);
+    editorUpdateRow(row);
+    E.dirty++;
+}
+void editorRowDelRange(erow *row, int at, int len) {
+    if (at < 0 || at >= row->size || len <= 0) return;
+    if (at + len > row->size) len = row->size - at;
+    wordIndexRegion(row, at, at + len, -1);
+    memmove(&row->characters[at], &row->characters[at + len], row->size - at - len + 1);
+    row->size -= len;
+    wordIndexRegion(row, at, at, 1);
+    editorUpdateRow(row);
+    E.dirty++;
+}
+void editorRowTruncate(erow *row, int at) {
+    if (at < 0 || at >= row->size) return;
+    wordIndexRegion(row, at, row->size, -1);
+    row->size = at;
+    row->characters[at] = '\0';
+    wordIndexRegion(row, at, at, 1);
+    editorUpdateRow(row);
+}
+struct editorClipboard {
+    erow *rows;
+    int number_of_rows;
+    char *block;
+} clipboard;
+void editorClipboardFree() {
+    if (!clipboard.block) {
+        for (int j = 0; j < clipboard.number_of_rows; j++)
+            editorFreeRow(&clipboard.rows[j]);
+    }
+    free(clipboard.block);
+    free(clipboard.rows);
+    clipboard.rows = NULL;
+    clipboard.number_of_rows = 0;
+    clipboard.block = NULL;
+}
+void editorClearSelection() {
+    if (E.selection_active) E.screen_dirty = 1;
+    E.selection_active = 0;
+}
+void editorStartSelection() {
+    if (E.selection_active) return;
+    E.selection_active = 1;
+    E.selection_anchor_x = E.file_position_x;
+    E.selection_anchor_y = E.file_position_y;
+}
+int editorSelectionBounds(int *start_y, int *start_x, int *end_y, int *end_x) {
+    if (!E.selection_active || E.number_of_rows == 0) return 0;
+    int ay = E.selection_anchor_y, ax = E.selection_anchor_x;
+    int by = E.file_position_y, bx = E.file_position_x;
+    if (ay >= E.number_of_rows) { ay = E.number_of_rows - 1; ax = E.row[ay].size; }
+    if (by >= E.number_of_rows) { by = E.number_of_rows - 1; bx = E.row[by].size; }
+    if (ax > E.row[ay].size) ax = E.row[ay].size;
+    if (bx > E.row[by].size) bx = E.row[by].size;
+    if (ay > by || (ay == by && ax > bx)) {
+        int t = ay; ay = by; by = t;
+        t = ax; ax = bx; bx = t;
+    }
+    if (ay == by && ax == bx) return 0;
+    *start_y = ay; *start_x = ax;
+    *end_y = by; *end_x = bx;
+    return 1;
+}
+int editorRowSelectionRange(erow *row, int *sel_start, int *sel_end) {
+    int sy, sx, ey, ex;
+    if (!editorSelectionBounds(&sy, &sx, &ey, &ex)) return 0;
+    if (row->index < sy || row->index > ey) return 0;
+    int from = row->index == sy ? sx : 0;
+    int to = row->index == ey ? ex : row->size;
+    *sel_start = editorRowFilePositionXToScreenPositionX(row, from);
+    *sel_end = editorRowFilePositionXToScreenPositionX(row, to);
+    return *sel_end > *sel_start;
+}
+void editorCutRange(int sy, int sx, int ey, int ex, int keep) {
+    erow *moved = NULL;
+    if (keep) {
+        editorClipboardFree();
+        clipboard.number_of_rows = ey - sy + 1;
+        clipboard.rows = safeMalloc(sizeof(erow) * clipboard.number_of_rows);
+        moved = clipboard.rows + 1;
+    }
+    if (sy == ey) {
+        if (keep) editorInitRow(&clipboard.rows[0], 0, &E.row[sy].characters[sx], ex - sx);
+        editorRowDelRange(&E.row[sy], sx, ex - sx);
+        return;
+    }
+    erow *first = &E.row[sy];
+    if (keep) editorInitRow(&clipboard.rows[0], 0, &first->characters[sx], first->size - sx);
+    editorRowTruncate(first, sx);
+    erow *last = &E.row[ey];
+    editorRowAppendString(first, &last->characters[ex], last->size - ex);
+    editorRemoveRows(sy + 1, ey - sy, moved);
+    if (keep) {
+        for (int j = 0; j < clipboard.number_of_rows; j++)
+            clipboard.rows[j].index = j;
+        editorRowTruncate(&clipboard.rows[clipboard.number_of_rows - 1], ex);
+    }
+}
+int editorDeleteSelection() {
+    int sy, sx, ey, ex;
+    if (!editorSelectionBounds(&sy, &sx, &ey, &ex)) {
+        editorClearSelection();
+        return 0;
+    }
+    editorCutRange(sy, sx, ey, ex, 0);
+    E.file_position_y = sy;
+    E.file_position_x = sx;
+    editorClearSelection();
+    E.screen_dirty = 1;
+    return 1;
+}
+void editorCopySelection() {
+    int sy, sx, ey, ex;
+    if (!editorSelectionBounds(&sy, &sx, &ey, &ex)) {
+        editorSetStatusMessage("Nothing selected");
+        return;
+    }
+    editorClipboardFree();
+    clipboard.number_of_rows = ey - sy + 1;
+    clipboard.rows = safeMalloc(sizeof(erow) * clipboard.number_of_rows);
+    size_t total = 0;
+    for (int j = sy; j <= ey; j++)
+        total += E.row[j].size + 1;
+    clipboard.block = safeMalloc(total);
+    char *p = clipboard.block;
+    for (int j = sy; j <= ey; j++) {
+        int from = j == sy ? sx : 0;
+        int to = j == ey ? ex : E.row[j].size;
+        erow *row = &clipboard.rows[j - sy];
+        row->index = j - sy;
+        row->size = to - from;
+        row->capacity = 0;
+        row->characters = p;
+        row->rendered_characters = NULL;
+        row->rendered_size = 0;
+        row->rendered_capacity = 0;
+        row->hash_valid = 0;
+        memcpy(p, &E.row[j].characters[from], row->size);
+        p[row->size] = '\0';
+        p += row->size + 1;
+    }
+    editorSetStatusMessage("%d lines copied", clipboard.number_of_rows);
+}
+void editorCutSelection() {
+    int sy, sx, ey, ex;
+    if (!editorSelectionBounds(&sy, &sx, &ey, &ex)) {
+        editorSetStatusMessage("Nothing selected");
+        return;
+    }
+    editorCutRange(sy, sx, ey, ex, 1);
+    E.file_position_y = sy;
+    E.file_position_x = sx;
+    editorClearSelection();
+    editorSetStatusMessage("%d lines cut", clipboard.number_of_rows);
+}
+void editorPaste() {
+    if (!clipboard.number_of_rows) {
+        editorSetStatusMessage("Clipboard is empty");
+        return;
+    }
+    editorDeleteSelection();
+    for (int i = E.number_of_rows; i <= E.file_position_y; i++)
+        editorInsertRow(i, "", 0);
+    erow *row = &E.row[E.file_position_y];
+    if (E.file_position_x > row->size) E.file_position_x = row->size;
+    erow *first = &clipboard.rows[0];
+    if (clipboard.number_of_rows == 1) {
+        editorRowInsertString(row, E.file_position_x, first->characters, first->size);
+        E.file_position_x += first->size;
+        return;
+    }
+    int count = clipboard.number_of_rows - 1;
+    erow *rows = safeMalloc(sizeof(erow) * count);
+    for (int j = 0; j < count - 1; j++)
+        editorInitRow(&rows[j], 0, clipboard.rows[j + 1].characters, clipboard.rows[j + 1].size);
+    erow *last = &clipboard.rows[count];
+    int tail_len = row->size - E.file_position_x;
+    char *joined = safeMalloc(last->size + tail_len + 1);
+    memcpy(joined, last->characters, last->size);
+    memcpy(joined + last->size, &row->characters[E.file_position_x], tail_len);
+    editorInitRow(&rows[count - 1], 0, joined, last->size + tail_len);
+    free(joined);
+    editorRowTruncate(row, E.file_position_x);
+    editorRowAppendString(row, first->characters, first->size);
+    editorInsertRows(E.file_position_y + 1, rows, count);
+    free(rows);
+    E.file_position_y += count;
+    E.file_position_x = last->size;
+}
 #if !defined(_SSIZE_T_DEFINED)
 typedef long ssize_t;
 #define _SSIZE_T_DEFINED
@@ -350,23 +1692,373 @@ char *editorRowsToString(int *buflen) {
     }
     return buf;
 }
+struct searchHistory {
+    char entries[SEARCH_HISTORY_MAX][SEARCH_HISTORY_LENGTH];
+    int count;
+} search_history;
+struct lineIndexHeader {
+    char magic[8];
+    unsigned long long file_size;
+    unsigned long long file_mtime;
+    unsigned long long line_count;
+    unsigned int path_length;
+    int file_position_x;
+    int file_position_y;
+    int row_offset;
+    int column_offset;
+    struct searchHistory history;
+};
+struct lineIndexJob {
+    char *index_path;
+    char *path;
+    struct lineIndexHeader header;
+    unsigned long long *offsets;
+};
+void searchHistoryAdd(const char *query) {
+    if (!query || !*query || strlen(query) >= SEARCH_HISTORY_LENGTH) return;
+    int i;
+    for (i = 0; i < search_history.count; i++) {
+        if (strcmp(search_history.entries[i], query) == 0) break;
+    }
+    if (i == search_history.count && search_history.count < SEARCH_HISTORY_MAX) search_history.count++;
+    if (i == search_history.count) i = search_history.count - 1;
+    memmove(search_history.entries[1], search_history.entries[0], (size_t)i * SEARCH_HISTORY_LENGTH);
+    strcpy(search_history.entries[0], query);
+}
+void searchHistoryMerge(const struct searchHistory *history) {
+    for (int i = history->count - 1; i >= 0; i--) {
+        if (memchr(history->entries[i], '\0', SEARCH_HISTORY_LENGTH)) searchHistoryAdd(history->entries[i]);
+    }
+}
+int editorLineIndexPath(const char *filename, char *full_path, char *index_path) {
+    DWORD path_length = GetFullPathName(filename, MAX_PATH, full_path, NULL);
+    if (path_length == 0 || path_length >= MAX_PATH) return 0;
+    char base[MAX_PATH];
+    DWORD base_length = GetEnvironmentVariable("LOCALAPPDATA", base, sizeof(base));
+    if (base_length == 0) base_length = GetEnvironmentVariable("TEMP", base, sizeof(base));
+    if (base_length == 0 || base_length >= sizeof(base)) return 0;
+    unsigned long long hash = 14695981039346656037ull;
+    for (const char *p = full_path; *p; p++) {
+        hash ^= (unsigned char)tolower((unsigned char)*p);
+        hash *= 1099511628211ull;
+    }
+    int length = snprintf(index_path, MAX_PATH, "%s\\ite", base);
+    if (length < 0 || length >= MAX_PATH) return 0;
+    CreateDirectory(index_path, NULL);
+    length = snprintf(index_path, MAX_PATH, "%s\\ite\\%016llx.idx", base, hash);
+    return length > 0 && length < MAX_PATH;
+}
+int editorReadLineIndexHeader(FILE *fp, const char *full_path, struct lineIndexHeader *header) {
+    char path[MAX_PATH];
+    if (fread(header, sizeof(*header), 1, fp) != 1) return 0;
+    if (memcmp(header->magic, LINE_INDEX_MAGIC, sizeof(header->magic)) != 0) return 0;
+    if (header->path_length >= MAX_PATH || fread(path, 1, header->path_length, fp) != header->path_length) return 0;
+    path[header->path_length] = '\0';
+    return strcmp(path, full_path) == 0;
+}
+int editorLineIndexValid(const unsigned long long *offsets, unsigned long long line_count, unsigned long long file_size) {
+    if (line_count == 0) return file_size == 0;
+    if (line_count > INT_MAX || offsets[0] != 0) return 0;
+    for (unsigned long long i = 1; i < line_count; i++) {
+        if (offsets[i] <= offsets[i - 1]) return 0;
+    }
+    return offsets[line_count - 1] < file_size;
+}
+DWORD WINAPI editorLineIndexWriter(LPVOID arg) {
+    struct lineIndexJob *job = arg;
+    char tmp_path[MAX_PATH + 4];
+    snprintf(tmp_path, sizeof(tmp_path), "%s.tmp", job->index_path);
+    FILE *fp = fopen(tmp_path, "wb");
+    if (fp) {
+        int ok = fwrite(&job->header, sizeof(job->header), 1, fp) == 1 &&
+                 fwrite(job->path, 1, job->header.path_length, fp) == job->header.path_length &&
+                 fwrite(job->offsets, sizeof(unsigned long long), (size_t)job->header.line_count, fp) == job->header.line_count;
+        if (fclose(fp) == 0 && ok) MoveFileEx(tmp_path, job->index_path, MOVEFILE_REPLACE_EXISTING);
+        else remove(tmp_path);
+    }
+    free(job->index_path);
+    free(job->path);
+    free(job->offsets);
+    free(job);
+    return 0;
+}
+void editorWaitLineIndex(struct editorConfig *b) {
+    if (!b->line_index_thread) return;
+    WaitForSingleObject(b->line_index_thread, INFINITE);
+    CloseHandle(b->line_index_thread);
+    b->line_index_thread = NULL;
+}
+void editorWriteLineIndex(unsigned long long *offsets, unsigned long long line_count) {
+    char full_path[MAX_PATH], index_path[MAX_PATH];
+    if (!E.filename || !editorLineIndexPath(E.filename, full_path, index_path)) {
+        free(offsets);
+        return;
+    }
+    editorWaitLineIndex(&E);
+    struct lineIndexJob *job = safeMalloc(sizeof(*job));
+    memset(&job->header, 0, sizeof(job->header));
+    memcpy(job->header.magic, LINE_INDEX_MAGIC, sizeof(job->header.magic));
+    job->header.file_size = E.file_size;
+    job->header.file_mtime = E.file_mtime;
+    job->header.line_count = line_count;
+    job->header.path_length = (unsigned int)strlen(full_path);
+    job->header.file_position_x = E.file_position_x;
+    job->header.file_position_y = E.file_position_y;
+    job->header.row_offset = E.row_offset;
+    job->header.column_offset = E.column_offset;
+    job->header.history = search_history;
+    job->index_path = strdup(index_path);
+    job->path = strdup(full_path);
+    job->offsets = offsets;
+    if (!job->index_path || !job->path) die("Memory allocation failure in editorWriteLineIndex");
+    E.line_index_thread = CreateThread(NULL, 0, editorLineIndexWriter, job, 0, NULL);
+    if (!E.line_index_thread) editorLineIndexWriter(job);
+}
+void editorSaveSession(struct editorConfig *b) {
+    char full_path[MAX_PATH], index_path[MAX_PATH];
+    editorWaitLineIndex(b);
+    if (!b->filename || !editorLineIndexPath(b->filename, full_path, index_path)) return;
+    FILE *fp = fopen(index_path, "r+b");
+    if (!fp) return;
+    struct lineIndexHeader header;
+    if (editorReadLineIndexHeader(fp, full_path, &header)) {
+        header.file_position_x = b->file_position_x;
+        header.file_position_y = b->file_position_y;
+        header.row_offset = b->row_offset;
+        header.column_offset = b->column_offset;
+        header.history = search_history;
+        fseek(fp, 0, SEEK_SET);
+        fwrite(&header, sizeof(header), 1, fp);
+    }
+    fclose(fp);
+}
+int editorFileStat(const char *filename, unsigned long long *size, unsigned long long *mtime) {
+    WIN32_FILE_ATTRIBUTE_DATA attributes;
+    if (!GetFileAttributesEx(filename, GetFileExInfoStandard, &attributes)) return 0;
+    *size = ((unsigned long long)attributes.nFileSizeHigh << 32) | attributes.nFileSizeLow;
+    *mtime = ((unsigned long long)attributes.ftLastWriteTime.dwHighDateTime << 32) | attributes.ftLastWriteTime.dwLowDateTime;
+    return 1;
+}
+int gzipDetect(const char *data, unsigned long long size) {
+#ifdef ITE_HAVE_ZLIB
+    return size >= 2 && (unsigned char)data[0] == 0x1f && (unsigned char)data[1] == 0x8b;
+#else
+    (void)data;
+    (void)size;
+    return 0;
+#endif
+}
+void gzipReset(struct gzipState *gz) {
+    gz->enabled = 0;
+    gz->level = -1;
+}
+#ifdef ITE_HAVE_ZLIB
+struct gzipScan {
+    char *line;
+    size_t line_length, line_capacity;
+    void (*emit)(const char *s, size_t len, void *arg);
+    void *arg;
+};
+void gzipScanAppend(struct gzipScan *scan, const char *s, size_t len) {
+    if (scan->line_length + len > scan->line_capacity) {
+        scan->line_capacity = (scan->line_length + len) * 2;
+        scan->line = realloc(scan->line, scan->line_capacity);
+        if (!scan->line) die("Memory allocation failure in gzipScanAppend");
+    }
+    memcpy(scan->line + scan->line_length, s, len);
+    scan->line_length += len;
+}
+void gzipScanOutput(struct gzipScan *scan, const char *s, size_t len) {
+    const char *end = s + len;
+    while (s < end) {
+        const char *nl = memchr(s, '\n', end - s);
+        if (!nl) {
+            gzipScanAppend(scan, s, end - s);
+            break;
+        }
+        if (scan->line_length) {
+            gzipScanAppend(scan, s, nl - s);
+            scan->emit(scan->line, scan->line_length, scan->arg);
+            scan->line_length = 0;
+        } else {
+            scan->emit(s, nl - s, scan->arg);
+        }
+        s = nl + 1;
+    }
+}
+int gzipInflate(const unsigned char *data, unsigned long long size, void (*emit)(const char *s, size_t len, void *arg), void *arg) {
+    struct gzipScan scan = { NULL, 0, 0, emit, arg };
+    z_stream strm;
+    memset(&strm, 0, sizeof(strm));
+    if (inflateInit2(&strm, 47) != Z_OK) die("inflateInit2");
+    unsigned char *out = safeMalloc(GZIP_CHUNK_SIZE);
+    unsigned long long next_in = 0;
+    int ret = Z_BUF_ERROR;
+    do {
+        if (strm.avail_in == 0) {
+            if (next_in >= size) break;
+            strm.next_in = (unsigned char *)data + next_in;
+            strm.avail_in = size - next_in > (1u << 30) ? (1u << 30) : (uInt)(size - next_in);
+            next_in += strm.avail_in;
+        }
+        strm.next_out = out;
+        strm.avail_out = GZIP_CHUNK_SIZE;
+        ret = inflate(&strm, Z_NO_FLUSH);
+        if (ret != Z_OK && ret != Z_STREAM_END && ret != Z_BUF_ERROR) break;
+        gzipScanOutput(&scan, (const char *)out, GZIP_CHUNK_SIZE - strm.avail_out);
+        if (ret == Z_STREAM_END) {
+            unsigned long long at = next_in - strm.avail_in;
+            if (at + 1 >= size || data[at] != 0x1f || data[at + 1] != 0x8b) break;
+            inflateReset(&strm);
+        }
+    } while (ret != Z_BUF_ERROR || strm.avail_in == 0);
+    if (scan.line_length) emit(scan.line, scan.line_length, arg);
+    inflateEnd(&strm);
+    free(out);
+    free(scan.line);
+    return ret == Z_STREAM_END;
+}
+void gzipAppendRow(const char *s, size_t len, void *arg) {
+    (void)arg;
+    while (len > 0 && (s[len - 1] == '\r' || s[len - 1] == '\n')) len--;
+    editorReserveRows(E.number_of_rows + 1);
+    editorInitRow(&E.row[E.number_of_rows], E.number_of_rows, s, len);
+    E.number_of_rows++;
+}
+struct gzipText {
+    char *data;
+    size_t length, capacity;
+};
+void gzipAppendText(const char *s, size_t len, void *arg) {
+    struct gzipText *text = arg;
+    if (text->length + len + 1 > text->capacity) {
+        text->capacity = (text->length + len + 1) * 2;
+        text->data = realloc(text->data, text->capacity);
+        if (!text->data) die("Memory allocation failure in gzipAppendText");
+    }
+    memcpy(text->data + text->length, s, len);
+    text->length += len;
+    text->data[text->length++] = '\n';
+}
+#endif
+int editorOpenGzip(const char *data, unsigned long long size) {
+#ifdef ITE_HAVE_ZLIB
+    E.gzip.enabled = 1;
+    return gzipInflate((const unsigned char *)data, size, gzipAppendRow, NULL);
+#else
+    (void)data;
+    (void)size;
+    return 0;
+#endif
+}
+char *editorInflateFile(const char *data, unsigned long long size, unsigned long long *length) {
+#ifdef ITE_HAVE_ZLIB
+    struct gzipText text = { NULL, 0, 0 };
+    gzipInflate((const unsigned char *)data, size, gzipAppendText, &text);
+    *length = text.length;
+    return text.data;
+#else
+    (void)data;
+    (void)size;
+    *length = 0;
+    return NULL;
+#endif
+}
 void editorOpen(char *filename) {
     free(E.filename);
     E.filename = strdup(filename);
     if (!E.filename) die("Memory allocation failure for filename");
-    if (_access(filename, 0) == 0) {
-        FILE *fp = fopen(filename, "r");
-        if (!fp) die("Cannot open file");
-        char *line = NULL;
-        size_t linecap = 0;
-        ssize_t linelen;
-        while ((linelen = win_getline(&line, &linecap, fp)) != -1) {
-            while (linelen > 0 && (line[linelen - 1] == '\n' || line[linelen - 1] == '\r')) linelen--;
-            editorInsertRow(E.number_of_rows, line, linelen);
-        }
-        free(line);
-        fclose(fp);
+    E.dirty = 0;
+    gzipReset(&E.gzip);
+    if (!editorFileStat(filename, &E.file_size, &E.file_mtime)) return;
+    char full_path[MAX_PATH], index_path[MAX_PATH];
+    struct lineIndexHeader header;
+    unsigned long long *offsets = NULL, line_count = 0;
+    int have_session = 0, have_index = 0;
+    if (editorLineIndexPath(filename, full_path, index_path)) {
+        FILE *fp = fopen(index_path, "rb");
+        if (fp) {
+            have_session = editorReadLineIndexHeader(fp, full_path, &header);
+            if (have_session && header.file_size == E.file_size && header.file_mtime == E.file_mtime &&
+                header.line_count <= E.file_size) {
+                line_count = header.line_count;
+                offsets = safeMalloc(sizeof(unsigned long long) * (line_count + 1));
+                have_index = fread(offsets, sizeof(unsigned long long), (size_t)line_count, fp) == line_count &&
+                             editorLineIndexValid(offsets, line_count, E.file_size);
+                if (!have_index) {
+                    free(offsets);
+                    offsets = NULL;
+                }
+            }
+            fclose(fp);
+        }
+    }
+    HANDLE hFile = CreateFile(filename, GENERIC_READ, FILE_SHARE_READ | FILE_SHARE_WRITE, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+    if (hFile == INVALID_HANDLE_VALUE) die("Cannot open file");
+    HANDLE hMap = NULL;
+    const char *data = NULL;
+    if (E.file_size > 0) {
+        hMap = CreateFileMapping(hFile, NULL, PAGE_READONLY, 0, 0, NULL);
+        if (!hMap) die("CreateFileMapping");
+        data = MapViewOfFile(hMap, FILE_MAP_READ, 0, 0, 0);
+        if (!data) die("MapViewOfFile");
+    }
+    if (gzipDetect(data, E.file_size)) {
+        if (have_index) free(offsets);
+        have_index = 0;
+        offsets = NULL;
+        if (!editorOpenGzip(data, E.file_size))
+            editorSetStatusMessage("gzip: %s is truncated or corrupt", filename);
+    } else {
+        if (!have_index) {
+            size_t capacity = 1024;
+            offsets = safeMalloc(sizeof(unsigned long long) * capacity);
+            line_count = 0;
+            const char *p = data, *end = data + E.file_size;
+            while (p < end) {
+                if (line_count == capacity) {
+                    capacity *= 2;
+                    unsigned long long *grown = realloc(offsets, sizeof(unsigned long long) * capacity);
+                    if (!grown) die("Memory allocation failure in editorOpen");
+                    offsets = grown;
+                }
+                offsets[line_count++] = p - data;
+                const char *nl = memchr(p, '\n', end - p);
+                p = nl ? nl + 1 : end;
+            }
+        }
+        editorReserveRows((int)line_count);
+        for (unsigned long long i = 0; i < line_count; i++) {
+            unsigned long long start = offsets[i];
+            unsigned long long stop = i + 1 < line_count ? offsets[i + 1] : E.file_size;
+            while (stop > start && (data[stop - 1] == '\n' || data[stop - 1] == '\r')) stop--;
+            editorInitRow(&E.row[i], (int)i, data + start, (size_t)(stop - start));
+        }
+        E.number_of_rows = (int)line_count;
     }
+    bracketTreesInvalidate();
+    if (E.gzip.enabled) {
+        E.words.stale = 1;
+        if (hMap) {
+            UnmapViewOfFile(data);
+            CloseHandle(hMap);
+        }
+    } else if (hMap) {
+        editorBuildWordIndex(data, E.file_size, hMap);
+    }
+    CloseHandle(hFile);
+    if (have_session) {
+        searchHistoryMerge(&header.history);
+        if (header.file_position_y >= 0 && header.file_position_y < E.number_of_rows) {
+            E.file_position_y = header.file_position_y;
+            E.file_position_x = header.file_position_x;
+            if (E.file_position_x < 0 || E.file_position_x > E.row[E.file_position_y].size) E.file_position_x = 0;
+            E.row_offset = header.row_offset >= 0 && header.row_offset <= E.file_position_y ? header.row_offset : E.file_position_y;
+            E.column_offset = header.column_offset >= 0 ? header.column_offset : 0;
+        }
+    }
+    if (have_index || E.gzip.enabled) free(offsets);
+    else editorWriteLineIndex(offsets, line_count);
     E.dirty = 0;
 }
 int editorConfirm(const char *prompt, char default_yes) {
@@ -376,81 +2068,857 @@ int editorConfirm(const char *prompt, char default_yes) {
     editorSetStatusMessage("");
     return default_yes ? (c == '\r' || tolower(c) == 'y') : (tolower(c) == 'y');
 }
-int editorSave() {
-    if (!E.filename) {
-        E.filename = editorPrompt("File: %s", NULL);
-        if (!E.filename) {
-            editorSetStatusMessage("Save aborted");
-            return 0;
+#ifdef ITE_HAVE_ZLIB
+int gzipDeflate(z_stream *strm, HANDLE hFile, const char *s, size_t len, int flush) {
+    unsigned char out[GZIP_CHUNK_SIZE];
+    DWORD bytesWritten;
+    strm->next_in = (unsigned char *)s;
+    strm->avail_in = (uInt)len;
+    do {
+        strm->next_out = out;
+        strm->avail_out = sizeof(out);
+        if (deflate(strm, flush) == Z_STREAM_ERROR) return 0;
+        DWORD produced = sizeof(out) - strm->avail_out;
+        if (produced && (!WriteFile(hFile, out, produced, &bytesWritten, NULL) || bytesWritten != produced)) return 0;
+    } while (strm->avail_out == 0);
+    return 1;
+}
+#endif
+int editorSaveGzip() {
+#ifdef ITE_HAVE_ZLIB
+    char tmp_path[MAX_PATH + 4];
+    snprintf(tmp_path, sizeof(tmp_path), "%s.tmp", E.filename);
+    HANDLE hOut = CreateFile(tmp_path, GENERIC_WRITE, 0, NULL, CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL, NULL);
+    if (hOut == INVALID_HANDLE_VALUE) return 0;
+    z_stream strm;
+    memset(&strm, 0, sizeof(strm));
+    int level = E.gzip.level >= 0 ? E.gzip.level : gzip_level;
+    int ok = deflateInit2(&strm, level, Z_DEFLATED, 31, 8, Z_DEFAULT_STRATEGY) == Z_OK;
+    if (ok) {
+        for (int j = 0; ok && j < E.number_of_rows; j++) {
+            ok = gzipDeflate(&strm, hOut, E.row[j].characters, E.row[j].size, Z_NO_FLUSH) &&
+                 gzipDeflate(&strm, hOut, "\n", 1, Z_NO_FLUSH);
+        }
+        ok = ok && gzipDeflate(&strm, hOut, NULL, 0, Z_FINISH);
+        deflateEnd(&strm);
+    }
+    CloseHandle(hOut);
+    if (!ok || !MoveFileEx(tmp_path, E.filename, MOVEFILE_REPLACE_EXISTING)) {
+        remove(tmp_path);
+        return 0;
+    }
+    return 1;
+#else
+    return 0;
+#endif
+}
+void editorSetGzip(const char *arg) {
+#ifdef ITE_HAVE_ZLIB
+    if (strcmp(arg, "off") == 0) {
+        gzipReset(&E.gzip);
+        editorSetStatusMessage("gzip: off");
+    } else if (isdigit((unsigned char)*arg) && atoi(arg) <= 9) {
+        E.gzip.enabled = 1;
+        E.gzip.level = atoi(arg);
+        editorSetStatusMessage("gzip: level %d", E.gzip.level);
+    } else {
+        editorSetStatusMessage("Usage: gzip 0-9|off");
+        return;
+    }
+    E.dirty++;
+#else
+    (void)arg;
+    editorSetStatusMessage("gzip: not available in this build");
+#endif
+}
+int editorSave() {
+    if (!E.filename) {
+        E.filename = editorPrompt("File: %s", NULL, NULL);
+        if (!E.filename) {
+            editorSetStatusMessage("Save aborted");
+            return 0;
+        }
+    }
+    if (E.gzip.enabled) {
+        if (!editorSaveGzip()) {
+            editorSetStatusMessage("Save error: gzip write failed");
+            return 0;
+        }
+    } else {
+        editorWordIndexReady(&E, 1);
+        HANDLE hFile = CreateFile(E.filename, GENERIC_WRITE, 0, NULL, CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL, NULL);
+        if (hFile == INVALID_HANDLE_VALUE) {
+            editorSetStatusMessage("Save error: Cannot create file");
+            return 0;
+        }
+        DWORD bytesWritten;
+        for (int j = 0; j < E.number_of_rows; j++) {
+            if (!WriteFile(hFile, E.row[j].characters, E.row[j].size, &bytesWritten, NULL) || bytesWritten != E.row[j].size) {
+                CloseHandle(hFile);
+                editorSetStatusMessage("Save error: Write failed");
+                return 0;
+            }
+            char nl = '\n';
+            if (!WriteFile(hFile, &nl, 1, &bytesWritten, NULL) || bytesWritten != 1) {
+                CloseHandle(hFile);
+                editorSetStatusMessage("Save error: Write failed");
+                return 0;
+            }
+        }
+        CloseHandle(hFile);
+    }
+    E.dirty = 0;
+    if (editorFileStat(E.filename, &E.file_size, &E.file_mtime) && !E.gzip.enabled) {
+        unsigned long long *offsets = safeMalloc(sizeof(unsigned long long) * (E.number_of_rows + 1));
+        unsigned long long offset = 0;
+        for (int j = 0; j < E.number_of_rows; j++) {
+            offsets[j] = offset;
+            offset += E.row[j].size + 1;
+        }
+        editorWriteLineIndex(offsets, E.number_of_rows);
+    }
+    editorSetStatusMessage("%d lines written", E.number_of_rows);
+    return 1;
+}
+static int last_find_match = -1;
+static int last_find_direction = 1;
+void editorFindCallback(char *query, int key) {
+    if (!query || !*query) {
+        last_find_match = -1;
+        return;
+    }
+    if (key == '\r' || key == '\x1b') {
+        last_find_match = -1;
+        last_find_direction = 1;
+        return;
+    }
+    int direction = (key == ARROW_RIGHT || key == ARROW_DOWN) ? 1 : (key == ARROW_LEFT || key == ARROW_UP) ? -1 : last_find_direction;
+    if (last_find_match == -1) direction = 1;
+    int current = (last_find_match == -1) ? E.file_position_y : last_find_match;
+    size_t qlen = strlen(query);
+    for (int i = 0; i < E.number_of_rows; i++) {
+        current = (current + direction + E.number_of_rows) % E.number_of_rows;
+        erow *row = &E.row[current];
+        if (row->render_stale) editorRenderRow(row);
+        char *match = strstr(row->rendered_characters, query);
+        if (match) {
+            last_find_match = current;
+            E.file_position_y = current;
+            E.file_position_x = editorRowScreenPositionXToFilePositionX(row, editorRenderedByteToColumn(row, match - row->rendered_characters));
+            foldReveal(current);
+            E.row_offset = E.number_of_rows;
+            break;
+        }
+    }
+}
+void editorFind() {
+    int saved_file_position_x = E.file_position_x;
+    int saved_file_position_y = E.file_position_y;
+    int saved_row_offset = E.row_offset;
+    int saved_col_offset = E.column_offset;
+    char *query = editorPrompt("Search: %s", editorFindCallback, &search_history);
+    if (query) {
+        searchHistoryAdd(query);
+        free(query);
+    }
+    else {
+        E.file_position_x = saved_file_position_x;
+        E.file_position_y = saved_file_position_y;
+        E.row_offset = saved_row_offset;
+        E.column_offset = saved_col_offset;
+    }
+}
+struct diffLine {
+    const char *text;
+    int size;
+    unsigned int hash;
+};
+struct diffContext {
+    struct diffLine *old_lines;
+    char *old_changed;
+    char *new_changed;
+    int *fdiag;
+    int *bdiag;
+    int too_expensive;
+};
+struct diffView {
+    int active;
+    char **lines;
+    int num_lines;
+    int lines_capacity;
+    int *hunk_line;
+    int *hunk_row;
+    int num_hunks;
+    int hunks_capacity;
+    int current_hunk;
+    int offset;
+    int added;
+    int removed;
+} diff_view;
+unsigned int editorHashLine(const char *s, int len) {
+    unsigned int h = 2166136261u;
+    for (int i = 0; i < len; i++) {
+        h ^= (unsigned char)s[i];
+        h *= 16777619u;
+    }
+    return h;
+}
+unsigned int editorRowHash(erow *row) {
+    if (!row->hash_valid) {
+        row->hash = editorHashLine(row->characters, row->size);
+        row->hash_valid = 1;
+    }
+    return row->hash;
+}
+int diffLinesEqual(struct diffContext *ctx, int x, int y) {
+    struct diffLine *a = &ctx->old_lines[x];
+    erow *b = &E.row[y];
+    return a->hash == editorRowHash(b) && a->size == b->size && memcmp(a->text, b->characters, a->size) == 0;
+}
+void diffSplit(struct diffContext *ctx, int xoff, int xlim, int yoff, int ylim, int *xmid, int *ymid) {
+    int *fd = ctx->fdiag, *bd = ctx->bdiag;
+    int dmin = xoff - ylim, dmax = xlim - yoff;
+    int fmid = xoff - yoff, bmid = xlim - ylim;
+    int fmin = fmid, fmax = fmid, bmin = bmid, bmax = bmid;
+    int odd = (fmid - bmid) & 1;
+    fd[fmid] = xoff;
+    bd[bmid] = xlim;
+    for (int c = 1;; c++) {
+        int d;
+        if (fmin > dmin) fd[--fmin - 1] = -1;
+        else ++fmin;
+        if (fmax < dmax) fd[++fmax + 1] = -1;
+        else --fmax;
+        for (d = fmax; d >= fmin; d -= 2) {
+            int tlo = fd[d - 1], thi = fd[d + 1];
+            int x = tlo < thi ? thi : tlo + 1;
+            int y = x - d;
+            while (x < xlim && y < ylim && diffLinesEqual(ctx, x, y)) { x++; y++; }
+            fd[d] = x;
+            if (odd && bmin <= d && d <= bmax && bd[d] <= x) {
+                *xmid = x;
+                *ymid = y;
+                return;
+            }
+        }
+        if (bmin > dmin) bd[--bmin - 1] = INT_MAX;
+        else ++bmin;
+        if (bmax < dmax) bd[++bmax + 1] = INT_MAX;
+        else --bmax;
+        for (d = bmax; d >= bmin; d -= 2) {
+            int tlo = bd[d - 1], thi = bd[d + 1];
+            int x = tlo < thi ? tlo : thi - 1;
+            int y = x - d;
+            while (xoff < x && yoff < y && diffLinesEqual(ctx, x - 1, y - 1)) { x--; y--; }
+            bd[d] = x;
+            if (!odd && fmin <= d && d <= fmax && x <= fd[d]) {
+                *xmid = x;
+                *ymid = y;
+                return;
+            }
+        }
+        if (c < ctx->too_expensive) continue;
+        int fxybest = -1, fxbest = 0, bxybest = INT_MAX, bxbest = 0;
+        for (d = fmax; d >= fmin; d -= 2) {
+            int x = fd[d] < xlim ? fd[d] : xlim;
+            int y = x - d;
+            if (ylim < y) { x = ylim + d; y = ylim; }
+            if (fxybest < x + y) { fxybest = x + y; fxbest = x; }
+        }
+        for (d = bmax; d >= bmin; d -= 2) {
+            int x = bd[d] > xoff ? bd[d] : xoff;
+            int y = x - d;
+            if (y < yoff) { x = yoff + d; y = yoff; }
+            if (x + y < bxybest) { bxybest = x + y; bxbest = x; }
+        }
+        if ((xlim + ylim) - bxybest < fxybest - (xoff + yoff)) {
+            *xmid = fxbest;
+            *ymid = fxybest - fxbest;
+        } else {
+            *xmid = bxbest;
+            *ymid = bxybest - bxbest;
+        }
+        return;
+    }
+}
+void diffCompare(struct diffContext *ctx, int xoff, int xlim, int yoff, int ylim) {
+    while (xoff < xlim && yoff < ylim && diffLinesEqual(ctx, xoff, yoff)) { xoff++; yoff++; }
+    while (xoff < xlim && yoff < ylim && diffLinesEqual(ctx, xlim - 1, ylim - 1)) { xlim--; ylim--; }
+    if (xoff == xlim) {
+        memset(ctx->new_changed + yoff, 1, ylim - yoff);
+    } else if (yoff == ylim) {
+        memset(ctx->old_changed + xoff, 1, xlim - xoff);
+    } else {
+        int xmid, ymid;
+        diffSplit(ctx, xoff, xlim, yoff, ylim, &xmid, &ymid);
+        diffCompare(ctx, xoff, xmid, yoff, ymid);
+        diffCompare(ctx, xmid, xlim, ymid, ylim);
+    }
+}
+void diffViewFree() {
+    for (int i = 0; i < diff_view.num_lines; i++) free(diff_view.lines[i]);
+    free(diff_view.lines);
+    free(diff_view.hunk_line);
+    free(diff_view.hunk_row);
+    memset(&diff_view, 0, sizeof(diff_view));
+}
+void diffViewAppend(char prefix, const char *s, int len) {
+    if (diff_view.num_lines == diff_view.lines_capacity) {
+        diff_view.lines_capacity = diff_view.lines_capacity ? diff_view.lines_capacity * 2 : 64;
+        char **lines = realloc(diff_view.lines, sizeof(char *) * diff_view.lines_capacity);
+        if (!lines) die("Memory allocation failure in diffViewAppend");
+        diff_view.lines = lines;
+    }
+    int width = 1;
+    for (int j = 0; j < len; j++)
+        width += s[j] == '\t' ? ITE_TAB_STOP - ((width - 1) % ITE_TAB_STOP) : 1;
+    char *line = safeMalloc(width + 1);
+    int idx = 0;
+    line[idx++] = prefix;
+    for (int j = 0; j < len; j++) {
+        if (s[j] == '\t') {
+            do line[idx++] = ' '; while ((idx - 1) % ITE_TAB_STOP);
+        } else {
+            line[idx++] = s[j];
+        }
+    }
+    line[idx] = '\0';
+    diff_view.lines[diff_view.num_lines++] = line;
+}
+void diffViewAddHunk(struct diffContext *ctx, int a0, int a1, int b0, int b1) {
+    if (diff_view.num_hunks == diff_view.hunks_capacity) {
+        diff_view.hunks_capacity = diff_view.hunks_capacity ? diff_view.hunks_capacity * 2 : 16;
+        int *hunk_line = realloc(diff_view.hunk_line, sizeof(int) * diff_view.hunks_capacity);
+        int *hunk_row = realloc(diff_view.hunk_row, sizeof(int) * diff_view.hunks_capacity);
+        if (!hunk_line || !hunk_row) die("Memory allocation failure in diffViewAddHunk");
+        diff_view.hunk_line = hunk_line;
+        diff_view.hunk_row = hunk_row;
+    }
+    char header[80];
+    int len = snprintf(header, sizeof(header), "@@ -%d,%d +%d,%d @@", a0 + 1, a1 - a0, b0 + 1, b1 - b0);
+    diff_view.hunk_line[diff_view.num_hunks] = diff_view.num_lines;
+    diff_view.hunk_row[diff_view.num_hunks] = b0;
+    diff_view.num_hunks++;
+    diffViewAppend('@', header + 1, len - 1);
+    int i = a0, j = b0;
+    while (i < a1 || j < b1) {
+        if (i < a1 && ctx->old_changed[i]) {
+            diffViewAppend('-', ctx->old_lines[i].text, ctx->old_lines[i].size);
+            diff_view.removed++;
+            i++;
+        } else if (j < b1 && ctx->new_changed[j]) {
+            diffViewAppend('+', E.row[j].characters, E.row[j].size);
+            diff_view.added++;
+            j++;
+        } else {
+            diffViewAppend(' ', E.row[j].characters, E.row[j].size);
+            i++;
+            j++;
+        }
+    }
+}
+void editorDiff() {
+    if (!E.filename) {
+        editorSetStatusMessage("Diff: buffer has no file");
+        return;
+    }
+    HANDLE hFile = CreateFile(E.filename, GENERIC_READ, FILE_SHARE_READ | FILE_SHARE_WRITE, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+    if (hFile == INVALID_HANDLE_VALUE) {
+        editorSetStatusMessage("Diff: cannot open %s", E.filename);
+        return;
+    }
+    LARGE_INTEGER file_size;
+    if (!GetFileSizeEx(hFile, &file_size)) file_size.QuadPart = 0;
+    HANDLE hMap = NULL;
+    const char *data = "";
+    if (file_size.QuadPart > 0) {
+        hMap = CreateFileMapping(hFile, NULL, PAGE_READONLY, 0, 0, NULL);
+        data = hMap ? MapViewOfFile(hMap, FILE_MAP_READ, 0, 0, 0) : NULL;
+        if (!data) {
+            if (hMap) CloseHandle(hMap);
+            CloseHandle(hFile);
+            editorSetStatusMessage("Diff: cannot map %s", E.filename);
+            return;
+        }
+    }
+    const char *mapped = data;
+    unsigned long long data_size = file_size.QuadPart;
+    char *inflated = NULL;
+    if (gzipDetect(data, data_size)) {
+        inflated = editorInflateFile(data, data_size, &data_size);
+        data = inflated ? inflated : "";
+    }
+    const char *p = data, *end = data + data_size;
+    int old_count = 0, old_capacity = 1024;
+    struct diffLine *old_lines = safeMalloc(sizeof(struct diffLine) * old_capacity);
+    while (p < end) {
+        const char *nl = memchr(p, '\n', end - p);
+        const char *line_end = nl ? nl : end;
+        const char *trimmed = line_end;
+        while (trimmed > p && (trimmed[-1] == '\r' || trimmed[-1] == '\n')) trimmed--;
+        if (old_count == old_capacity) {
+            old_capacity *= 2;
+            struct diffLine *grown = realloc(old_lines, sizeof(struct diffLine) * old_capacity);
+            if (!grown) die("Memory allocation failure in editorDiff");
+            old_lines = grown;
+        }
+        old_lines[old_count].text = p;
+        old_lines[old_count].size = (int)(trimmed - p);
+        old_lines[old_count].hash = editorHashLine(p, (int)(trimmed - p));
+        old_count++;
+        p = nl ? nl + 1 : end;
+    }
+    int new_count = E.number_of_rows;
+    struct diffContext ctx;
+    ctx.old_lines = old_lines;
+    ctx.old_changed = calloc(old_count + 1, 1);
+    ctx.new_changed = calloc(new_count + 1, 1);
+    int diags = old_count + new_count + 3;
+    ctx.fdiag = safeMalloc(sizeof(int) * diags * 2);
+    ctx.bdiag = ctx.fdiag + diags;
+    ctx.fdiag += new_count + 1;
+    ctx.bdiag += new_count + 1;
+    if (!ctx.old_changed || !ctx.new_changed) die("Memory allocation failure in editorDiff");
+    ctx.too_expensive = 1;
+    for (int d = diags; d; d >>= 2) ctx.too_expensive <<= 1;
+    if (ctx.too_expensive < 4096) ctx.too_expensive = 4096;
+    diffCompare(&ctx, 0, old_count, 0, new_count);
+    diffViewFree();
+    int i = 0, j = 0;
+    while (i < old_count || j < new_count) {
+        if ((i < old_count && ctx.old_changed[i]) || (j < new_count && ctx.new_changed[j])) {
+            int a0 = i, b0 = j, a1, b1, equal;
+            do {
+                while (i < old_count && ctx.old_changed[i]) i++;
+                while (j < new_count && ctx.new_changed[j]) j++;
+                a1 = i;
+                b1 = j;
+                equal = 0;
+                while (i < old_count && j < new_count && !ctx.old_changed[i] && !ctx.new_changed[j] && equal <= 2 * DIFF_CONTEXT) {
+                    i++;
+                    j++;
+                    equal++;
+                }
+            } while (equal <= 2 * DIFF_CONTEXT && ((i < old_count && ctx.old_changed[i]) || (j < new_count && ctx.new_changed[j])));
+            int context_before = a0 < DIFF_CONTEXT ? a0 : DIFF_CONTEXT;
+            int context_after = equal < DIFF_CONTEXT ? equal : DIFF_CONTEXT;
+            diffViewAddHunk(&ctx, a0 - context_before, a1 + context_after, b0 - context_before, b1 + context_after);
+            i = a1 + equal;
+            j = b1 + equal;
+        } else {
+            i++;
+            j++;
+        }
+    }
+    free(ctx.fdiag - (new_count + 1));
+    free(ctx.old_changed);
+    free(ctx.new_changed);
+    free(old_lines);
+    free(inflated);
+    if (hMap) {
+        UnmapViewOfFile(mapped);
+        CloseHandle(hMap);
+    }
+    CloseHandle(hFile);
+    if (!diff_view.num_hunks) {
+        diffViewFree();
+        editorSetStatusMessage("No changes against %s", E.filename);
+        return;
+    }
+    diff_view.active = 1;
+    E.screen_dirty = 1;
+}
+void diffViewShowHunk(int hunk) {
+    if (hunk < 0 || hunk >= diff_view.num_hunks) return;
+    diff_view.current_hunk = hunk;
+    diff_view.offset = diff_view.hunk_line[hunk];
+}
+void editorDiffViewProcessKey(int c) {
+    int max_offset = diff_view.num_lines - E.screen_rows;
+    if (max_offset < 0) max_offset = 0;
+    switch (c) {
+        case 'n': case '\t':
+            diffViewShowHunk(diff_view.current_hunk + 1);
+            break;
+        case 'p':
+            diffViewShowHunk(diff_view.current_hunk - 1);
+            break;
+        case ARROW_DOWN:
+            diff_view.offset++;
+            break;
+        case ARROW_UP:
+            diff_view.offset--;
+            break;
+        case PAGE_DOWN:
+            diff_view.offset += E.screen_rows;
+            break;
+        case PAGE_UP:
+            diff_view.offset -= E.screen_rows;
+            break;
+        case '\r':
+            E.file_position_y = diff_view.hunk_row[diff_view.current_hunk];
+            E.file_position_x = 0;
+            diffViewFree();
+            break;
+        case 'q': case CTRL_KEY('q'): case '\x1b':
+            diffViewFree();
+            break;
+    }
+    if (diff_view.active) {
+        if (diff_view.offset > max_offset) diff_view.offset = max_offset;
+        if (diff_view.offset < 0) diff_view.offset = 0;
+        while (diff_view.current_hunk + 1 < diff_view.num_hunks && diff_view.hunk_line[diff_view.current_hunk + 1] <= diff_view.offset)
+            diff_view.current_hunk++;
+        while (diff_view.current_hunk > 0 && diff_view.hunk_line[diff_view.current_hunk] > diff_view.offset)
+            diff_view.current_hunk--;
+    }
+    editorSetStatusMessage("");
+    E.screen_dirty = 1;
+}
+struct hexPage {
+    unsigned long long page;
+    unsigned char *bytes;
+};
+struct hexView {
+    int active;
+    char *filename;
+    HANDLE file;
+    HANDLE map;
+    const unsigned char *data;
+    unsigned long long size;
+    unsigned long long offset;
+    unsigned long long cursor;
+    int nibble;
+    int ascii;
+    struct hexPage *pages;
+    int num_pages;
+    int pages_capacity;
+} hex_view;
+void hexViewFree() {
+    if (hex_view.data) UnmapViewOfFile(hex_view.data);
+    if (hex_view.map) CloseHandle(hex_view.map);
+    if (hex_view.file && hex_view.file != INVALID_HANDLE_VALUE) CloseHandle(hex_view.file);
+    for (int i = 0; i < hex_view.num_pages; i++)
+        free(hex_view.pages[i].bytes);
+    free(hex_view.pages);
+    free(hex_view.filename);
+    memset(&hex_view, 0, sizeof(hex_view));
+    E.screen_dirty = 1;
+}
+int hexViewFindPage(unsigned long long page, int *insert_at) {
+    int lo = 0, hi = hex_view.num_pages;
+    while (lo < hi) {
+        int mid = (lo + hi) / 2;
+        if (hex_view.pages[mid].page < page) lo = mid + 1;
+        else hi = mid;
+    }
+    if (insert_at) *insert_at = lo;
+    return lo < hex_view.num_pages && hex_view.pages[lo].page == page ? lo : -1;
+}
+int hexViewByte(unsigned long long offset, int *patched) {
+    int index = hexViewFindPage(offset / HEX_PAGE_SIZE, NULL);
+    *patched = index >= 0 && hex_view.pages[index].bytes[offset % HEX_PAGE_SIZE] != hex_view.data[offset];
+    return index >= 0 ? hex_view.pages[index].bytes[offset % HEX_PAGE_SIZE] : hex_view.data[offset];
+}
+void hexViewPatch(unsigned long long offset, unsigned char value) {
+    unsigned long long page = offset / HEX_PAGE_SIZE;
+    int at, index = hexViewFindPage(page, &at);
+    if (index < 0) {
+        if (hex_view.num_pages == hex_view.pages_capacity) {
+            hex_view.pages_capacity = hex_view.pages_capacity ? hex_view.pages_capacity * 2 : 16;
+            struct hexPage *grown = realloc(hex_view.pages, sizeof(struct hexPage) * hex_view.pages_capacity);
+            if (!grown) die("Memory allocation failure in hexViewPatch");
+            hex_view.pages = grown;
         }
+        memmove(&hex_view.pages[at + 1], &hex_view.pages[at], sizeof(struct hexPage) * (hex_view.num_pages - at));
+        unsigned long long start = page * HEX_PAGE_SIZE;
+        size_t length = hex_view.size - start < HEX_PAGE_SIZE ? (size_t)(hex_view.size - start) : HEX_PAGE_SIZE;
+        hex_view.pages[at].page = page;
+        hex_view.pages[at].bytes = safeMalloc(HEX_PAGE_SIZE);
+        memcpy(hex_view.pages[at].bytes, hex_view.data + start, length);
+        hex_view.num_pages++;
+        index = at;
+    }
+    hex_view.pages[index].bytes[offset % HEX_PAGE_SIZE] = value;
+}
+void editorHexView(const char *filename) {
+    if (!filename || !*filename) {
+        editorSetStatusMessage("Hex: no file");
+        return;
+    }
+    hexViewFree();
+    hex_view.file = CreateFile(filename, GENERIC_READ, FILE_SHARE_READ | FILE_SHARE_WRITE, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+    LARGE_INTEGER file_size;
+    if (hex_view.file == INVALID_HANDLE_VALUE || !GetFileSizeEx(hex_view.file, &file_size) || file_size.QuadPart == 0) {
+        editorSetStatusMessage("Hex: cannot open %s or file is empty", filename);
+        hexViewFree();
+        return;
     }
-    HANDLE hFile = CreateFile(E.filename, GENERIC_WRITE, 0, NULL, CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL, NULL);
+    hex_view.size = file_size.QuadPart;
+    hex_view.map = CreateFileMapping(hex_view.file, NULL, PAGE_READONLY, 0, 0, NULL);
+    hex_view.data = hex_view.map ? MapViewOfFile(hex_view.map, FILE_MAP_READ, 0, 0, 0) : NULL;
+    if (!hex_view.data) {
+        editorSetStatusMessage("Hex: cannot map %s", filename);
+        hexViewFree();
+        return;
+    }
+    hex_view.filename = strdup(filename);
+    if (!hex_view.filename) die("Memory allocation failure for filename");
+    hex_view.active = 1;
+    editorSetStatusMessage("");
+}
+int hexViewSave() {
+    HANDLE hFile = CreateFile(hex_view.filename, GENERIC_WRITE, FILE_SHARE_READ | FILE_SHARE_WRITE, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
     if (hFile == INVALID_HANDLE_VALUE) {
-        editorSetStatusMessage("Save error: Cannot create file");
+        editorSetStatusMessage("Save error: Cannot open %s for writing", hex_view.filename);
         return 0;
     }
-    DWORD bytesWritten;
-    for (int j = 0; j < E.number_of_rows; j++) {
-        if (!WriteFile(hFile, E.row[j].characters, E.row[j].size, &bytesWritten, NULL) || bytesWritten != E.row[j].size) {
-            CloseHandle(hFile);
-            editorSetStatusMessage("Save error: Write failed");
-            return 0;
-        }
-        char nl = '\n';
-        if (!WriteFile(hFile, &nl, 1, &bytesWritten, NULL) || bytesWritten != 1) {
+    int written = 0;
+    for (; written < hex_view.num_pages; written++) {
+        struct hexPage *page = &hex_view.pages[written];
+        LARGE_INTEGER position;
+        position.QuadPart = page->page * HEX_PAGE_SIZE;
+        DWORD length = hex_view.size - position.QuadPart < HEX_PAGE_SIZE ? (DWORD)(hex_view.size - position.QuadPart) : HEX_PAGE_SIZE;
+        DWORD bytesWritten;
+        if (!SetFilePointerEx(hFile, position, NULL, FILE_BEGIN) ||
+            !WriteFile(hFile, page->bytes, length, &bytesWritten, NULL) || bytesWritten != length) {
             CloseHandle(hFile);
-            editorSetStatusMessage("Save error: Write failed");
+            editorSetStatusMessage("Save error: Write failed at 0x%llx", page->page * HEX_PAGE_SIZE);
             return 0;
         }
     }
     CloseHandle(hFile);
-    E.dirty = 0;
-    editorSetStatusMessage("%d lines written", E.number_of_rows);
+    for (int i = 0; i < hex_view.num_pages; i++)
+        free(hex_view.pages[i].bytes);
+    hex_view.num_pages = 0;
+    editorSetStatusMessage("%d pages written", written);
     return 1;
 }
-static int last_find_match = -1;
-static int last_find_direction = 1;
-void editorFindCallback(char *query, int key) {
-    if (!query || !*query) {
-        last_find_match = -1;
-        return;
+void hexViewMove(long long delta) {
+    long long cursor = (long long)hex_view.cursor + delta;
+    if (cursor < 0) cursor = 0;
+    if ((unsigned long long)cursor >= hex_view.size) cursor = hex_view.size - 1;
+    hex_view.cursor = cursor;
+    hex_view.nibble = 0;
+}
+void editorHexViewProcessKey(int c) {
+    long long page = (long long)HEX_BYTES_PER_LINE * (E.screen_rows > 0 ? E.screen_rows : 1);
+    switch (c) {
+        case ARROW_LEFT: hexViewMove(-1); break;
+        case ARROW_RIGHT: hexViewMove(1); break;
+        case ARROW_UP: hexViewMove(-HEX_BYTES_PER_LINE); break;
+        case ARROW_DOWN: hexViewMove(HEX_BYTES_PER_LINE); break;
+        case PAGE_UP: hexViewMove(-page); break;
+        case PAGE_DOWN: hexViewMove(page); break;
+        case HOME_KEY: hexViewMove(-(long long)(hex_view.cursor % HEX_BYTES_PER_LINE)); break;
+        case END_KEY: hexViewMove(HEX_BYTES_PER_LINE - 1 - (long long)(hex_view.cursor % HEX_BYTES_PER_LINE)); break;
+        case '\t':
+            hex_view.ascii = !hex_view.ascii;
+            hex_view.nibble = 0;
+            break;
+        case CTRL_KEY('g'): {
+            char *target = editorPrompt("Goto offset (hex): %s", NULL, NULL);
+            if (target) {
+                hexViewMove((long long)(strtoull(target, NULL, 16) - hex_view.cursor));
+                free(target);
+            }
+            break;
+        }
+        case CTRL_KEY('s'):
+            hexViewSave();
+            break;
+        case CTRL_KEY('q'): case '\x1b':
+            if (hex_view.num_pages && !editorConfirm("Discard patched bytes? (y/N)", 0)) break;
+            hexViewFree();
+            return;
+        default:
+            if (hex_view.ascii && c >= 32 && c < 127) {
+                hexViewPatch(hex_view.cursor, (unsigned char)c);
+                hexViewMove(1);
+            } else if (!hex_view.ascii && c < 128 && isxdigit(c)) {
+                int patched, value = hexViewByte(hex_view.cursor, &patched);
+                int digit = isdigit(c) ? c - '0' : tolower(c) - 'a' + 10;
+                value = hex_view.nibble ? (value & 0xf0) | digit : (value & 0x0f) | (digit << 4);
+                hexViewPatch(hex_view.cursor, (unsigned char)value);
+                if (hex_view.nibble) hexViewMove(1);
+                else hex_view.nibble = 1;
+            }
+            break;
     }
-    if (key == '\r' || key == '\x1b') {
-        last_find_match = -1;
-        last_find_direction = 1;
+    unsigned long long line = hex_view.cursor / HEX_BYTES_PER_LINE * HEX_BYTES_PER_LINE;
+    if (line < hex_view.offset) hex_view.offset = line;
+    if (line >= hex_view.offset + page) hex_view.offset = line - page + HEX_BYTES_PER_LINE;
+    E.screen_dirty = 1;
+}
+struct bracketTree *bracketTreeBuild() {
+    struct bracketTree *tree = &E.brackets;
+    if (tree->valid) return tree;
+    if (!tree->seed) tree->seed = 2463534242u;
+    tree->root = bracketBuildRange(tree, E.row, E.number_of_rows);
+    tree->valid = 1;
+    return tree;
+}
+int bracketFindForward(struct bracketTree *tree, int t, int base, int from, int type, int *depth) {
+    if (!t) return -1;
+    struct bracketNode *n = &tree->nodes[t];
+    if (base + n->size <= from) return -1;
+    if (base >= from && *depth + n->sum[type].min > 0) {
+        *depth += n->sum[type].net;
+        return -1;
+    }
+    int found = bracketFindForward(tree, n->left, base, from, type, depth);
+    if (found >= 0) return found;
+    int at = base + tree->nodes[n->left].size;
+    if (at >= from) {
+        if (*depth + n->row[type].min <= 0) return at;
+        *depth += n->row[type].net;
+    }
+    return bracketFindForward(tree, n->right, at + 1, from, type, depth);
+}
+int bracketFindBackward(struct bracketTree *tree, int t, int base, int before, int type, int *depth) {
+    if (!t || base >= before) return -1;
+    struct bracketNode *n = &tree->nodes[t];
+    if (base + n->size <= before && *depth + n->sum[type].min - n->sum[type].net > 0) {
+        *depth -= n->sum[type].net;
+        return -1;
+    }
+    int at = base + tree->nodes[n->left].size;
+    int found = bracketFindBackward(tree, n->right, at + 1, before, type, depth);
+    if (found >= 0) return found;
+    if (at < before) {
+        if (*depth + n->row[type].min - n->row[type].net <= 0) return at;
+        *depth -= n->row[type].net;
+    }
+    return bracketFindBackward(tree, n->left, base, before, type, depth);
+}
+int editorFindMatchingBracket(int y, int x, int *match_y, int *match_x) {
+    if (y < 0 || y >= E.number_of_rows || x < 0 || x >= E.row[y].size) return 0;
+    char c = E.row[y].characters[x];
+    int type, forward;
+    for (type = 0; type < BRACKET_TYPES; type++) {
+        if (c == bracket_open[type] || c == bracket_close[type]) break;
+    }
+    if (type == BRACKET_TYPES) return 0;
+    forward = c == bracket_open[type];
+    char open = bracket_open[type], close = bracket_close[type];
+    int depth = 1;
+    erow *row = &E.row[y];
+    if (forward) {
+        for (int j = x + 1; j < row->size; j++) {
+            depth += (row->characters[j] == open) - (row->characters[j] == close);
+            if (depth == 0) { *match_y = y; *match_x = j; return 1; }
+        }
+        struct bracketTree *tree = bracketTreeBuild();
+        int found = bracketFindForward(tree, tree->root, 0, y + 1, type, &depth);
+        if (found < 0 || found >= E.number_of_rows) return 0;
+        row = &E.row[found];
+        for (int j = 0; j < row->size; j++) {
+            depth += (row->characters[j] == open) - (row->characters[j] == close);
+            if (depth == 0) { *match_y = found; *match_x = j; return 1; }
+        }
+    } else {
+        for (int j = x - 1; j >= 0; j--) {
+            depth += (row->characters[j] == close) - (row->characters[j] == open);
+            if (depth == 0) { *match_y = y; *match_x = j; return 1; }
+        }
+        struct bracketTree *tree = bracketTreeBuild();
+        int found = bracketFindBackward(tree, tree->root, 0, y, type, &depth);
+        if (found < 0) return 0;
+        row = &E.row[found];
+        for (int j = row->size - 1; j >= 0; j--) {
+            depth += (row->characters[j] == close) - (row->characters[j] == open);
+            if (depth == 0) { *match_y = found; *match_x = j; return 1; }
+        }
+    }
+    return 0;
+}
+void editorJumpToMatchingBracket() {
+    int match_y, match_x;
+    if (!editorFindMatchingBracket(E.file_position_y, E.file_position_x, &match_y, &match_x)) {
+        editorSetStatusMessage("No matching bracket");
         return;
     }
-    int direction = (key == ARROW_RIGHT || key == ARROW_DOWN) ? 1 : (key == ARROW_LEFT || key == ARROW_UP) ? -1 : last_find_direction;
-    if (last_find_match == -1) direction = 1;
-    int current = (last_find_match == -1) ? E.file_position_y : last_find_match;
-    size_t qlen = strlen(query);
-    for (int i = 0; i < E.number_of_rows; i++) {
-        current = (current + direction + E.number_of_rows) % E.number_of_rows;
-        erow *row = &E.row[current];
-        char *match = strstr(row->rendered_characters, query);
-        if (match) {
-            last_find_match = current;
-            E.file_position_y = current;
-            E.file_position_x = editorRowScreenPositionXToFilePositionX(row, match - row->rendered_characters);
-            E.row_offset = E.number_of_rows;
-            break;
+    E.file_position_y = match_y;
+    E.file_position_x = match_x;
+    E.screen_dirty = 1;
+}
+int editorRowIndent(erow *row) {
+    int indent = 0;
+    for (int j = 0; j < row->size; j++) {
+        if (row->characters[j] == ' ') indent++;
+        else if (row->characters[j] == '\t') indent = (indent / ITE_TAB_STOP + 1) * ITE_TAB_STOP;
+        else return indent;
+    }
+    return -1;
+}
+int editorFoldRegion(int row, int *last) {
+    erow *header = &E.row[row];
+    int depth = 0;
+    for (int j = header->size - 1; j >= 0; j--) {
+        if (header->characters[j] == '}') {
+            depth++;
+        } else if (header->characters[j] == '{') {
+            if (depth == 0) {
+                int match_y, match_x;
+                if (editorFindMatchingBracket(row, j, &match_y, &match_x) && match_y - 1 > row) {
+                    *last = match_y - 1;
+                    return 1;
+                }
+                break;
+            }
+            depth--;
         }
     }
+    int indent = editorRowIndent(header);
+    if (indent < 0) return 0;
+    *last = row;
+    for (int j = row + 1; j < E.number_of_rows; j++) {
+        int inner = editorRowIndent(&E.row[j]);
+        if (inner < 0) continue;
+        if (inner <= indent) break;
+        *last = j;
+    }
+    return *last > row;
 }
-void editorFind() {
-    int saved_file_position_x = E.file_position_x;
-    int saved_file_position_y = E.file_position_y;
-    int saved_row_offset = E.row_offset;
-    int saved_col_offset = E.column_offset;
-    char *query = editorPrompt("Search: %s", editorFindCallback);
-    if (query)
-        free(query);
-    else {
-        E.file_position_x = saved_file_position_x;
-        E.file_position_y = saved_file_position_y;
-        E.row_offset = saved_row_offset;
-        E.column_offset = saved_col_offset;
+void editorToggleFold() {
+    if (E.file_position_y >= E.number_of_rows) return;
+    int index = foldFind(E.file_position_y, NULL), last;
+    if (index >= 0) {
+        foldRemove(index);
+        editorSetStatusMessage("Unfolded");
+    } else if (editorFoldRegion(E.file_position_y, &last)) {
+        foldAdd(E.file_position_y, last);
+        editorSetStatusMessage("Folded %d lines", last - E.file_position_y);
+    } else {
+        editorSetStatusMessage("Nothing to fold");
+    }
+    E.screen_dirty = 1;
+}
+void editorFoldAll() {
+    if (E.folds.count) {
+        E.folds.count = 0;
+        editorSetStatusMessage("Unfolded all");
+    } else {
+        int count = 0, capacity = 16;
+        struct foldRegion *regions = safeMalloc(sizeof(struct foldRegion) * capacity);
+        for (int row = 0; row < E.number_of_rows; row++) {
+            int last;
+            if (editorRowIndent(&E.row[row]) == 0 && editorFoldRegion(row, &last)) {
+                if (count == capacity) {
+                    capacity *= 2;
+                    struct foldRegion *grown = realloc(regions, sizeof(struct foldRegion) * capacity);
+                    if (!grown) die("Memory allocation failure in editorFoldAll");
+                    regions = grown;
+                }
+                regions[count].header = row;
+                regions[count++].last = last;
+                row = last;
+            }
+        }
+        foldRebuild(regions, count);
+        editorSetStatusMessage("%d folds", E.folds.count);
     }
+    E.screen_dirty = 1;
 }
 struct abuf {
     char *b;
@@ -474,18 +2942,105 @@ void abAppend(struct abuf *ab, const char *s, int len) {
     ab->len = new_len;
 }
 void abFree(struct abuf *ab) { free(ab->b); }
+void abAppendHighlighted(struct abuf *ab, const char *s, int len, int start, int end) {
+    if (start < 0) start = 0;
+    if (end > len) end = len;
+    if (start >= end) {
+        abAppend(ab, s, len);
+        return;
+    }
+    abAppend(ab, s, start);
+    abAppend(ab, "\x1b[7m", 4);
+    abAppend(ab, s + start, end - start);
+    abAppend(ab, "\x1b[27m", 5);
+    abAppend(ab, s + end, len - end);
+}
 
 void editorScroll() {
     E.screen_position_x = 0;
     if (E.file_position_y < E.number_of_rows)
         E.screen_position_x = editorRowFilePositionXToScreenPositionX(&E.row[E.file_position_y], E.file_position_x);
-    if (E.file_position_y < E.row_offset) E.row_offset = E.file_position_y;
-    if (E.file_position_y >= E.row_offset + E.screen_rows) E.row_offset = E.file_position_y - E.screen_rows + 1;
+    if (foldHidden(E.row_offset)) E.row_offset = foldPrevRow(E.row_offset);
+    int cursor_line = foldVisibleBefore(E.file_position_y), top_line = foldVisibleBefore(E.row_offset);
+    if (cursor_line < top_line) E.row_offset = E.file_position_y;
+    if (cursor_line >= top_line + E.screen_rows) E.row_offset = foldRowAtVisible(cursor_line - E.screen_rows + 1);
     if (E.screen_position_x < E.column_offset) E.column_offset = E.screen_position_x;
     if (E.screen_position_x >= E.column_offset + E.screen_columns) E.column_offset = E.screen_position_x - E.screen_columns + 1;
 }
+void editorDrawDiffView(struct abuf *ab) {
+    for (int y = 0; y < E.screen_rows; y++) {
+        int line = y + diff_view.offset;
+        if (line < diff_view.num_lines) {
+            char *s = diff_view.lines[line];
+            int len = (int)strlen(s);
+            if (len > E.screen_columns) len = E.screen_columns;
+            if (s[0] == '@') abAppend(ab, "\x1b[36m", 5);
+            else if (s[0] == '-') abAppend(ab, "\x1b[31m", 5);
+            else if (s[0] == '+') abAppend(ab, "\x1b[32m", 5);
+            abAppend(ab, s, len);
+            abAppend(ab, "\x1b[39m", 5);
+        } else {
+            abAppend(ab, "~", 1);
+        }
+        abAppend(ab, "\x1b[K", 3);
+        abAppend(ab, "\r\n", 2);
+    }
+}
+void hexAppend(struct abuf *ab, const char *s, int len, int *column) {
+    if (*column + len > E.screen_columns) len = E.screen_columns - *column;
+    abAppend(ab, s, len);
+    *column += len;
+}
+void hexAppendByte(struct abuf *ab, const char *s, int len, int *column, int cursor, int patched) {
+    if (*column + len > E.screen_columns) return;
+    if (cursor) abAppend(ab, "\x1b[7m", 4);
+    if (patched) abAppend(ab, "\x1b[31m", 5);
+    abAppend(ab, s, len);
+    if (patched) abAppend(ab, "\x1b[39m", 5);
+    if (cursor) abAppend(ab, "\x1b[27m", 5);
+    *column += len;
+}
+void editorDrawHexView(struct abuf *ab) {
+    int digits = hex_view.size > 0xffffffffULL ? 16 : 8;
+    for (int y = 0; y < E.screen_rows; y++) {
+        unsigned long long line = hex_view.offset + (unsigned long long)y * HEX_BYTES_PER_LINE;
+        if (line >= hex_view.size) {
+            abAppend(ab, "~", 1);
+        } else {
+            char buf[32];
+            int column = 0, values[HEX_BYTES_PER_LINE], patched[HEX_BYTES_PER_LINE];
+            int count = hex_view.size - line < HEX_BYTES_PER_LINE ? (int)(hex_view.size - line) : HEX_BYTES_PER_LINE;
+            for (int i = 0; i < count; i++)
+                values[i] = hexViewByte(line + i, &patched[i]);
+            int len = snprintf(buf, sizeof(buf), "\x1b[38;5;244m%0*llx\x1b[39m  ", digits, line);
+            abAppend(ab, buf, len);
+            column += digits + 2;
+            for (int i = 0; i < HEX_BYTES_PER_LINE; i++) {
+                if (i < count) {
+                    snprintf(buf, sizeof(buf), "%02x", values[i]);
+                    hexAppendByte(ab, buf, 2, &column, line + i == hex_view.cursor && !hex_view.ascii, patched[i]);
+                    hexAppend(ab, i == HEX_BYTES_PER_LINE / 2 - 1 ? "  " : " ", i == HEX_BYTES_PER_LINE / 2 - 1 ? 2 : 1, &column);
+                } else {
+                    hexAppend(ab, "    ", i == HEX_BYTES_PER_LINE / 2 - 1 ? 4 : 3, &column);
+                }
+            }
+            hexAppend(ab, " |", 2, &column);
+            for (int i = 0; i < count; i++) {
+                char ch = values[i] >= 32 && values[i] < 127 ? (char)values[i] : '.';
+                hexAppendByte(ab, &ch, 1, &column, line + i == hex_view.cursor && hex_view.ascii, patched[i]);
+            }
+            hexAppend(ab, "|", 1, &column);
+        }
+        abAppend(ab, "\x1b[K", 3);
+        abAppend(ab, "\r\n", 2);
+    }
+}
 void editorDrawRows(struct abuf *ab) {
-    if (E.terminal_output_mode) {
+    if (hex_view.active) {
+        editorDrawHexView(ab);
+    } else if (diff_view.active) {
+        editorDrawDiffView(ab);
+    } else if (E.terminal_output_mode) {
         for (int y = 0; y < E.screen_rows; y++) {
             if (y < E.terminal_output_num_lines) {
                 int len = (int)strlen(E.terminal_output_lines[y]);
@@ -503,17 +3058,65 @@ void editorDrawRows(struct abuf *ab) {
         while (max_lines >= 10) { max_lines /= 10; digits++; }
         int ln_width = digits + 3;
         int content_width = E.screen_columns - ln_width;
-        for (int y = 0; y < E.screen_rows; y++) {
-            int filerow = y + E.row_offset;
+        int match_y = -1, match_x = -1;
+        if (!editorFindMatchingBracket(E.file_position_y, E.file_position_x, &match_y, &match_x)) match_y = -1;
+        int filerow = E.row_offset;
+        for (int y = 0; y < E.screen_rows; y++, filerow = foldNextRow(filerow)) {
             char buf[32];
             if (filerow < E.number_of_rows) {
                 snprintf(buf, sizeof(buf), "\x1b[38;5;244m%*d\x1b[39m | ", digits, filerow + 1);
                 abAppend(ab, buf, (int)strlen(buf));
-                int len = E.row[filerow].rendered_size - E.column_offset;
-                if (len < 0) len = 0;
-                if (len > content_width) len = content_width;
-                char *c = &E.row[filerow].rendered_characters[E.column_offset];
-                abAppend(ab, c, len);
+                erow *row = &E.row[filerow];
+                int from = E.column_offset, len;
+                if (!row->has_multibyte) {
+                    len = row->rendered_size - E.column_offset;
+                    if (len < 0) len = 0;
+                    if (len > content_width) len = content_width;
+                    if (len == 0) from = 0;
+                } else {
+                    int to;
+                    editorRenderedColumnsToBytes(row, E.column_offset, E.column_offset + content_width, &from, &to);
+                    len = to - from;
+                }
+                char *c = &row->rendered_characters[from];
+                int sel_start, sel_end;
+                if (editorRowSelectionRange(row, &sel_start, &sel_end)) {
+                    if (row->has_multibyte) {
+                        int sel_from, sel_to;
+                        editorRenderedColumnsToBytes(row, sel_start, sel_end, &sel_from, &sel_to);
+                        sel_start = sel_from - from;
+                        sel_end = sel_to - from;
+                    } else {
+                        sel_start -= E.column_offset;
+                        sel_end -= E.column_offset;
+                    }
+                    abAppendHighlighted(ab, c, len, sel_start, sel_end);
+                } else if (filerow == match_y) {
+                    int match_col = editorRowFilePositionXToScreenPositionX(row, match_x), match_from, match_to;
+                    if (row->has_multibyte) {
+                        editorRenderedColumnsToBytes(row, match_col, match_col + 1, &match_from, &match_to);
+                        match_from -= from;
+                        match_to -= from;
+                    } else {
+                        match_from = match_col - E.column_offset;
+                        match_to = match_from + 1;
+                    }
+                    abAppendHighlighted(ab, c, len, match_from, match_to);
+                } else {
+                    abAppend(ab, c, len);
+                }
+                int hidden = foldHiddenBelow(filerow);
+                if (hidden) {
+                    char marker[32];
+                    int marker_len = snprintf(marker, sizeof(marker), " ... %d lines", hidden);
+                    int used = editorRowFilePositionXToScreenPositionX(row, row->size) - E.column_offset;
+                    if (used < 0) used = 0;
+                    if (used + marker_len <= content_width) {
+                        abAppend(ab, "\x1b[38;5;244m", 11);
+                        abAppend(ab, marker, marker_len);
+                        abAppend(ab, "\x1b[39m", 5);
+                    }
+                }
             } else {
                 snprintf(buf, sizeof(buf), "\x1b[38;5;244m%*s\x1b[39m   ", digits, "~");
                 abAppend(ab, buf, (int)strlen(buf));
@@ -534,15 +3137,35 @@ void editorDrawRows(struct abuf *ab) {
 void editorDrawStatusBar(struct abuf *ab) {
     abAppend(ab, "\x1b[7m", 4);
     char status[200];
-    if (E.terminal_output_mode) {
+    if (hex_view.active) {
+        snprintf(status, sizeof(status), "Hex %.30s: 0x%llx/0x%llx%s", hex_view.filename, hex_view.cursor, hex_view.size,
+                 hex_view.num_pages ? " +" : "");
+    } else if (diff_view.active) {
+        snprintf(status, sizeof(status), "Diff %.30s: hunk %d/%d (+%d -%d)", E.filename, diff_view.current_hunk + 1,
+                 diff_view.num_hunks, diff_view.added, diff_view.removed);
+    } else if (E.terminal_output_mode) {
         snprintf(status, sizeof(status), "Terminal");
     } else {
         char *fname = E.filename ? E.filename : "No name";
         int cur_line = (E.file_position_y < E.number_of_rows ? E.file_position_y + 1 : E.number_of_rows);
         int cur_col = E.file_position_x + 1;
-        snprintf(status, sizeof(status), "%.30s%s (%d,%d)", fname, E.dirty ? " +" : "", cur_line, cur_col);
+        char tag[32] = "";
+        if (buffers.count > 1) snprintf(tag, sizeof(tag), "[%d/%d] ", buffers.current + 1, buffers.count);
+        snprintf(status, sizeof(status), "%s%.30s%s (%d,%d)%s", tag, fname, E.dirty ? " +" : "", cur_line, cur_col,
+                 macro.recording ? " REC" : "");
     }
     int len = (int)strlen(status);
+    if (perf.overlay) {
+        char p50[16], p99[16], overlay[80];
+        perfFormat(p50, sizeof(p50), perfPercentile(PERF_LATENCY, 0.5));
+        perfFormat(p99, sizeof(p99), perfPercentile(PERF_LATENCY, 0.99));
+        int overlay_len = snprintf(overlay, sizeof(overlay), " | p50 %s p99 %s | %llu allocs %lluKB out", p50, p99,
+                                   perf.allocations, perf.bytes_written / 1024);
+        if (len + overlay_len < (int)sizeof(status)) {
+            memcpy(status + len, overlay, overlay_len + 1);
+            len += overlay_len;
+        }
+    }
     int filler = E.screen_columns - len;
     if (filler < 0) filler = 0;
     char *padded_status = malloc(len + filler + 1);
@@ -555,8 +3178,13 @@ void editorDrawStatusBar(struct abuf *ab) {
 }
 void editorDrawMessageBar(struct abuf *ab) {
     abAppend(ab, "\x1b[K", 3);
-    if (E.terminal_output_mode) {
-        char *msg = "Press Enter to continue...";
+    if (hex_view.active && !(E.status_message[0] && time(NULL) - E.status_message_time < 5)) {
+        char *msg = "Tab = hex/ascii | Ctrl-G = goto | Ctrl-S = write patched pages | Esc = close";
+        int msglen = (int)strlen(msg);
+        if (msglen > E.screen_columns) msglen = E.screen_columns;
+        abAppend(ab, msg, msglen);
+    } else if (diff_view.active || E.terminal_output_mode) {
+        char *msg = diff_view.active ? "n/p = next/prev hunk | Enter = jump to hunk | Esc = close" : "Press Enter to continue...";
         int msglen = (int)strlen(msg);
         if (msglen > E.screen_columns) msglen = E.screen_columns;
         abAppend(ab, msg, msglen);
@@ -568,7 +3196,9 @@ void editorDrawMessageBar(struct abuf *ab) {
     }
 }
 void editorRefreshScreen() {
-    if (E.in_terminal_mode || E.terminal_output_mode || E.screen_dirty) {
+    if (macro.replaying) return;
+    if (hex_view.active || diff_view.active || E.in_terminal_mode || E.terminal_output_mode || E.screen_dirty) {
+        LONGLONG draw_start = perfBegin();
         editorScroll();
         struct abuf ab = ABUF_INIT;
         abAppend(&ab, "\x1b[?25l", 4);
@@ -581,6 +3211,8 @@ void editorRefreshScreen() {
             snprintf(buf, sizeof(buf), "\x1b[%d;1H", E.screen_rows + 2);
             abAppend(&ab, buf, strlen(buf));
             snprintf(buf, sizeof(buf), "\x1b[%d;1H\x1b[?25h", E.screen_rows + 2);
+        } else if (hex_view.active || diff_view.active) {
+            snprintf(buf, sizeof(buf), "\x1b[H");
         } else if (E.terminal_output_mode) {
             snprintf(buf, sizeof(buf), "\x1b[%d;1H\x1b[?25h", E.screen_rows + 2);
         } else {
@@ -588,7 +3220,7 @@ void editorRefreshScreen() {
             int temp = E.number_of_rows;
             while (temp >= 10) { temp /= 10; ln_width++; }
             ln_width += 3;
-            int cursor_y = E.file_position_y - E.row_offset;
+            int cursor_y = foldVisibleBefore(E.file_position_y) - foldVisibleBefore(E.row_offset);
             int cursor_x = ln_width + (E.screen_position_x - E.column_offset);
             if (cursor_y >= E.screen_rows) cursor_y = E.screen_rows - 1;
             if (cursor_y < 0) cursor_y = 0;
@@ -596,7 +3228,12 @@ void editorRefreshScreen() {
             snprintf(buf, sizeof(buf), "\x1b[%d;%dH\x1b[?25h", cursor_y + 1, cursor_x + 1);
         }
         abAppend(&ab, buf, strlen(buf));
+        perfEnd(PERF_DRAW, draw_start);
+        LONGLONG write_start = perfBegin();
         _write(STDOUT_FILENO, ab.b, ab.len);
+        perfEnd(PERF_WRITE, write_start);
+        perf.bytes_written += ab.len;
+        perf.frames++;
         abFree(&ab);
         E.screen_dirty = 0;
     } else if (E.cursor_moved) {
@@ -605,15 +3242,22 @@ void editorRefreshScreen() {
         int temp = E.number_of_rows;
         while (temp >= 10) { temp /= 10; ln_width++; }
         ln_width += 3;
-        int cursor_y = E.file_position_y - E.row_offset;
+        int cursor_y = foldVisibleBefore(E.file_position_y) - foldVisibleBefore(E.row_offset);
         int cursor_x = ln_width + (E.screen_position_x - E.column_offset);
         if (cursor_y >= E.screen_rows) cursor_y = E.screen_rows - 1;
         if (cursor_y < 0) cursor_y = 0;
         if (cursor_x < ln_width) cursor_x = ln_width;
         snprintf(buf, sizeof(buf), "\x1b[%d;%dH", cursor_y + 1, cursor_x + 1);
+        LONGLONG write_start = perfBegin();
         _write(STDOUT_FILENO, buf, strlen(buf));
+        perfEnd(PERF_WRITE, write_start);
+        perf.bytes_written += strlen(buf);
         E.cursor_moved = 0;
     }
+    if (perf.key_time) {
+        perfRecord(PERF_LATENCY, perf.key_time, perfNow());
+        perf.key_time = 0;
+    }
 }
 void editorSetStatusMessage(const char *fmt, ...) {
     va_list ap;
@@ -624,8 +3268,9 @@ void editorSetStatusMessage(const char *fmt, ...) {
     E.screen_dirty = 1;
 }
 #define PROMPT_MAX_LENGTH 4096
-char *editorPrompt(char *prompt, void (*callback)(char *, int)) {
+char *editorPrompt(char *prompt, void (*callback)(char *, int), struct searchHistory *history) {
     size_t bufsize = 128, buflen = 0;
+    int history_index = -1;
     char *buf = malloc(bufsize);
     if (!buf) die("Memory allocation failure in editorPrompt");
     buf[0] = '\0';
@@ -646,7 +3291,21 @@ char *editorPrompt(char *prompt, void (*callback)(char *, int)) {
                 if (callback) callback(buf, c);
                 return buf;
             }
-        } else if (!iscntrl((unsigned char)c) && c < 128) {
+        } else if (history && (c == CTRL_KEY('p') || c == CTRL_KEY('n'))) {
+            int next = history_index + (c == CTRL_KEY('p') ? 1 : -1);
+            if (next >= -1 && next < history->count) {
+                history_index = next;
+                const char *entry = next >= 0 ? history->entries[next] : "";
+                buflen = strlen(entry);
+                if (buflen >= bufsize) {
+                    bufsize = buflen + 1;
+                    char *temp = realloc(buf, bufsize);
+                    if (!temp) { free(buf); die("Memory allocation failure in editorPrompt"); }
+                    buf = temp;
+                }
+                memcpy(buf, entry, buflen + 1);
+            }
+        } else if (!iscntrl((unsigned char)c) && c < 256) {
             if (buflen < PROMPT_MAX_LENGTH - 1) {
                 if (buflen == bufsize - 1) {
                     bufsize *= 2;
@@ -668,33 +3327,33 @@ void editorMoveCursor(int key) {
     switch (key) {
         case ARROW_LEFT:
             if (E.file_position_x)
-                E.file_position_x--;
+                E.file_position_x = row ? editorRowPrevCharStart(row, E.file_position_x) : E.file_position_x - 1;
             else if (E.file_position_y > 0) {
-                E.file_position_y--;
+                E.file_position_y = foldPrevRow(E.file_position_y);
                 E.file_position_x = E.row[E.file_position_y].size;
             }
             break;
         case ARROW_RIGHT:
             if (row && E.file_position_x < row->size)
-                E.file_position_x++;
+                E.file_position_x = editorRowNextCharStart(row, E.file_position_x);
             else if (row && E.file_position_x == row->size) {
                 if (E.file_position_y + 1 > E.number_of_rows) {
                     editorInsertRow(E.number_of_rows, "", 0);
                     E.screen_dirty = 1;
                 }
-                E.file_position_y++;
+                E.file_position_y = foldNextRow(E.file_position_y);
                 E.file_position_x = 0;
             }
             break;
         case ARROW_UP:
-            if (E.file_position_y) E.file_position_y--;
+            if (E.file_position_y) E.file_position_y = foldPrevRow(E.file_position_y);
             break;
         case ARROW_DOWN:
-            if (E.file_position_y < E.number_of_rows - 1) {
-                E.file_position_y++;
-            } else if (E.file_position_y == E.number_of_rows - 1) {
+            if (foldNextRow(E.file_position_y) < E.number_of_rows) {
+                E.file_position_y = foldNextRow(E.file_position_y);
+            } else if (E.file_position_y < E.number_of_rows) {
                 editorInsertRow(E.number_of_rows, "", 0);
-                E.file_position_y++;
+                E.file_position_y = E.number_of_rows - 1;
                 E.screen_dirty = 1;
             }
             break;
@@ -707,33 +3366,405 @@ void editorDelCharAtCursor() {
     if (E.file_position_y >= E.number_of_rows) return;
     erow *row = &E.row[E.file_position_y];
     if (E.file_position_x < row->size) {
-        editorRowDelChar(row, E.file_position_x);
+        int next = editorRowNextCharStart(row, E.file_position_x);
+        if (next - E.file_position_x == 1) editorRowDelChar(row, E.file_position_x);
+        else editorRowDelRange(row, E.file_position_x, next - E.file_position_x);
     } else if (E.file_position_x == row->size && E.file_position_y < E.number_of_rows - 1) {
         editorRowAppendString(row, E.row[E.file_position_y + 1].characters, E.row[E.file_position_y + 1].size);
         editorDelRow(E.file_position_y + 1);
     }
     E.dirty++;
 }
+void editorCopyScreenState(struct editorConfig *dst, const struct editorConfig *src) {
+    dst->screen_rows = src->screen_rows;
+    dst->screen_columns = src->screen_columns;
+    memcpy(dst->status_message, src->status_message, sizeof(dst->status_message));
+    dst->status_message_time = src->status_message_time;
+    dst->in_terminal_mode = src->in_terminal_mode;
+    memcpy(dst->terminal_input, src->terminal_input, sizeof(dst->terminal_input));
+    dst->terminal_input_len = src->terminal_input_len;
+    dst->terminal_output_mode = src->terminal_output_mode;
+    dst->terminal_output_lines = src->terminal_output_lines;
+    dst->terminal_output_num_lines = src->terminal_output_num_lines;
+    dst->terminal_history = src->terminal_history;
+    dst->terminal_history_num_lines = src->terminal_history_num_lines;
+    dst->terminal_height = src->terminal_height;
+    dst->screen_dirty = 1;
+    dst->cursor_moved = 0;
+}
+void editorSwitchBuffer(int index) {
+    if (index < 0 || index >= buffers.count || index == buffers.current) return;
+    if (macro.replaying) editorFlushStaleRows();
+    buffers.items[buffers.current] = E;
+    editorCopyScreenState(&buffers.items[index], &E);
+    E = buffers.items[index];
+    buffers.current = index;
+    editorSetStatusMessage("[%d/%d] %s", index + 1, buffers.count, E.filename ? E.filename : "No name");
+}
+void editorNewBuffer() {
+    if (buffers.count == buffers.capacity) {
+        buffers.capacity = buffers.capacity ? buffers.capacity * 2 : 4;
+        struct editorConfig *items = realloc(buffers.items, sizeof(struct editorConfig) * buffers.capacity);
+        if (!items) die("Memory allocation failure in editorNewBuffer");
+        buffers.items = items;
+    }
+    memset(&buffers.items[buffers.count], 0, sizeof(struct editorConfig));
+    buffers.count++;
+    editorSwitchBuffer(buffers.count - 1);
+}
+int editorFindBuffer(const char *filename) {
+    for (int i = 0; i < buffers.count; i++) {
+        char *name = i == buffers.current ? E.filename : buffers.items[i].filename;
+        if (name && strcmp(name, filename) == 0) return i;
+    }
+    return -1;
+}
+int editorBufferNeedsSave() {
+    if (!E.dirty) return 0;
+    if (E.filename) return 1;
+    for (int i = 0; i < E.number_of_rows; i++) {
+        if (E.row[i].size) return 1;
+    }
+    return 0;
+}
+void editorFreeBuffer() {
+    for (int i = 0; i < E.number_of_rows; i++)
+        editorFreeRow(&E.row[i]);
+    free(E.row);
+    free(E.filename);
+    free(E.brackets.nodes);
+    editorFreeWordIndex();
+    free(E.folds.span);
+    free(E.folds.hidden);
+    free(E.folds.span_tree);
+    free(E.folds.hidden_tree);
+}
+void editorOpenBuffer() {
+    char *filename = editorPrompt("Open: %s", NULL, NULL);
+    if (!filename) return;
+    int index = editorFindBuffer(filename);
+    if (index >= 0) {
+        editorSwitchBuffer(index);
+    } else {
+        editorNewBuffer();
+        editorOpen(filename);
+        editorSetStatusMessage("[%d/%d] %s", buffers.current + 1, buffers.count, E.filename);
+    }
+    free(filename);
+}
+void editorCloseBuffer() {
+    if (editorBufferNeedsSave() && editorConfirm("Save changes? (Y/n)", 1) && !editorSave()) return;
+    editorSaveSession(&E);
+    editorFreeBuffer();
+    struct editorConfig fresh;
+    memset(&fresh, 0, sizeof(fresh));
+    editorCopyScreenState(&fresh, &E);
+    if (buffers.count == 1) {
+        E = fresh;
+        editorSetStatusMessage("Buffer closed");
+        return;
+    }
+    int closed = buffers.current;
+    memmove(&buffers.items[closed], &buffers.items[closed + 1], sizeof(struct editorConfig) * (buffers.count - closed - 1));
+    buffers.count--;
+    buffers.current = closed > 0 ? closed - 1 : 0;
+    E = buffers.items[buffers.current];
+    editorCopyScreenState(&E, &fresh);
+    editorSetStatusMessage("[%d/%d] %s", buffers.current + 1, buffers.count, E.filename ? E.filename : "No name");
+}
+void editorListBuffers() {
+    char **lines = safeMalloc(sizeof(char *) * buffers.count);
+    for (int i = 0; i < buffers.count; i++) {
+        struct editorConfig *b = i == buffers.current ? &E : &buffers.items[i];
+        char line[256];
+        snprintf(line, sizeof(line), "%c %3d  %s%s (%d lines)", i == buffers.current ? '*' : ' ', i + 1,
+                 b->filename ? b->filename : "No name", b->dirty ? " +" : "", b->number_of_rows);
+        lines[i] = strdup(line);
+        if (!lines[i]) die("Memory allocation failure");
+    }
+    E.terminal_output_lines = lines;
+    E.terminal_output_num_lines = buffers.count;
+    E.terminal_output_mode = 1;
+}
 void editorQuit() {
-    if (!E.dirty || (E.filename == NULL && !E.number_of_rows)) {
-        exit(0);
+    int start = buffers.current;
+    for (int i = 0; i < buffers.count; i++) {
+        editorSwitchBuffer((start + i) % buffers.count);
+        if (editorBufferNeedsSave() && editorConfirm("Save changes? (Y/n)", 1) && !editorSave()) return;
+    }
+    for (int i = 0; i < buffers.count; i++)
+        editorSaveSession(i == buffers.current ? &E : &buffers.items[i]);
+    exit(0);
+}
+struct filterJob {
+    HANDLE pipe;
+    int start;
+    int end;
+};
+struct filterErrors {
+    HANDLE pipe;
+    char text[256];
+    DWORD length;
+};
+int filterWrite(HANDLE pipe, const char *s, DWORD len) {
+    DWORD written;
+    while (len > 0) {
+        if (!WriteFile(pipe, s, len, &written, NULL)) return 0;
+        s += written;
+        len -= written;
+    }
+    return 1;
+}
+DWORD WINAPI editorFilterWriter(LPVOID arg) {
+    struct filterJob *job = arg;
+    char buf[FILTER_CHUNK_SIZE];
+    DWORD len = 0;
+    for (int j = job->start; j < job->end; j++) {
+        erow *row = &E.row[j];
+        if (len + row->size + 1 > sizeof(buf)) {
+            if (!filterWrite(job->pipe, buf, len)) goto done;
+            len = 0;
+        }
+        if (row->size + 1 > (int)sizeof(buf)) {
+            if (!filterWrite(job->pipe, row->characters, row->size) || !filterWrite(job->pipe, "\n", 1)) goto done;
+            continue;
+        }
+        memcpy(buf + len, row->characters, row->size);
+        len += row->size;
+        buf[len++] = '\n';
+    }
+    filterWrite(job->pipe, buf, len);
+done:
+    CloseHandle(job->pipe);
+    return 0;
+}
+DWORD WINAPI editorFilterErrors(LPVOID arg) {
+    struct filterErrors *errors = arg;
+    char chunk[256];
+    DWORD bytes_read;
+    while (ReadFile(errors->pipe, chunk, sizeof(chunk), &bytes_read, NULL) && bytes_read > 0) {
+        DWORD room = sizeof(errors->text) - 1 - errors->length;
+        if (bytes_read > room) bytes_read = room;
+        memcpy(errors->text + errors->length, chunk, bytes_read);
+        errors->length += bytes_read;
+    }
+    errors->text[errors->length] = '\0';
+    CloseHandle(errors->pipe);
+    return 0;
+}
+void filterAppendRow(erow **rows, int *count, int *capacity, const char *s, size_t len) {
+    while (len > 0 && s[len - 1] == '\r') len--;
+    if (*count == *capacity) {
+        *capacity = *capacity ? *capacity * 2 : 256;
+        erow *grown = realloc(*rows, sizeof(erow) * *capacity);
+        if (!grown) die("Memory allocation failure in filterAppendRow");
+        *rows = grown;
+    }
+    editorInitRow(&(*rows)[*count], *count, s, len);
+    (*count)++;
+}
+void editorFilterRows(const char *command) {
+    struct filterJob job;
+    int sy, sx, ey, ex;
+    if (editorSelectionBounds(&sy, &sx, &ey, &ex)) {
+        job.start = sy;
+        job.end = (ex == 0 && ey > sy) ? ey : ey + 1;
+    } else {
+        job.start = 0;
+        job.end = E.number_of_rows;
+    }
+    SECURITY_ATTRIBUTES sa = { sizeof(SECURITY_ATTRIBUTES), NULL, TRUE };
+    HANDLE child_in_read, child_in_write, child_out_read, child_out_write, child_err_read, child_err_write;
+    if (!CreatePipe(&child_in_read, &child_in_write, &sa, 0)) {
+        editorSetStatusMessage("Filter error: cannot create pipe");
+        return;
+    }
+    if (!CreatePipe(&child_out_read, &child_out_write, &sa, 0)) {
+        CloseHandle(child_in_read);
+        CloseHandle(child_in_write);
+        editorSetStatusMessage("Filter error: cannot create pipe");
+        return;
+    }
+    if (!CreatePipe(&child_err_read, &child_err_write, &sa, 0)) {
+        CloseHandle(child_in_read);
+        CloseHandle(child_in_write);
+        CloseHandle(child_out_read);
+        CloseHandle(child_out_write);
+        editorSetStatusMessage("Filter error: cannot create pipe");
+        return;
+    }
+    SetHandleInformation(child_in_write, HANDLE_FLAG_INHERIT, 0);
+    SetHandleInformation(child_out_read, HANDLE_FLAG_INHERIT, 0);
+    SetHandleInformation(child_err_read, HANDLE_FLAG_INHERIT, 0);
+    STARTUPINFO si;
+    PROCESS_INFORMATION pi;
+    memset(&si, 0, sizeof(si));
+    si.cb = sizeof(si);
+    si.dwFlags = STARTF_USESTDHANDLES;
+    si.hStdInput = child_in_read;
+    si.hStdOutput = child_out_write;
+    si.hStdError = child_err_write;
+    size_t cmdlen = strlen(command) + 16;
+    char *cmdline = safeMalloc(cmdlen);
+    snprintf(cmdline, cmdlen, "cmd.exe /c %s", command);
+    BOOL started = CreateProcess(NULL, cmdline, NULL, NULL, TRUE, CREATE_NO_WINDOW, NULL, NULL, &si, &pi);
+    free(cmdline);
+    CloseHandle(child_in_read);
+    CloseHandle(child_out_write);
+    CloseHandle(child_err_write);
+    if (!started) {
+        CloseHandle(child_in_write);
+        CloseHandle(child_out_read);
+        CloseHandle(child_err_read);
+        editorSetStatusMessage("Filter error: cannot start command");
+        return;
     }
-    if (E.filename == NULL) {
-        for (int i = 0; i < E.number_of_rows; i++) {
-            if (E.row[i].size) {
-                goto ask;
+    job.pipe = child_in_write;
+    HANDLE writer = CreateThread(NULL, 0, editorFilterWriter, &job, 0, NULL);
+    if (!writer) CloseHandle(child_in_write);
+    struct filterErrors errors;
+    errors.pipe = child_err_read;
+    errors.length = 0;
+    errors.text[0] = '\0';
+    HANDLE error_reader = CreateThread(NULL, 0, editorFilterErrors, &errors, 0, NULL);
+    if (!error_reader) CloseHandle(child_err_read);
+    erow *rows = NULL;
+    int count = 0, capacity = 0;
+    char chunk[FILTER_CHUNK_SIZE];
+    char *pending = NULL;
+    size_t pending_len = 0, pending_capacity = 0;
+    DWORD bytes_read;
+    while (ReadFile(child_out_read, chunk, sizeof(chunk), &bytes_read, NULL) && bytes_read > 0) {
+        char *p = chunk, *end = chunk + bytes_read;
+        char *nl;
+        while ((nl = memchr(p, '\n', end - p)) != NULL) {
+            if (pending_len) {
+                size_t len = nl - p;
+                if (pending_len + len > pending_capacity) {
+                    pending_capacity = (pending_len + len) * 2;
+                    char *grown = realloc(pending, pending_capacity);
+                    if (!grown) die("Memory allocation failure in editorFilterRows");
+                    pending = grown;
+                }
+                memcpy(pending + pending_len, p, len);
+                filterAppendRow(&rows, &count, &capacity, pending, pending_len + len);
+                pending_len = 0;
+            } else {
+                filterAppendRow(&rows, &count, &capacity, p, nl - p);
+            }
+            p = nl + 1;
+        }
+        if (p < end) {
+            size_t len = end - p;
+            if (pending_len + len > pending_capacity) {
+                pending_capacity = (pending_len + len) * 2;
+                char *grown = realloc(pending, pending_capacity);
+                if (!grown) die("Memory allocation failure in editorFilterRows");
+                pending = grown;
             }
+            memcpy(pending + pending_len, p, len);
+            pending_len += len;
         }
-        exit(0);
     }
-ask:
-    if (editorConfirm("Save changes? (Y/n)", 1)) {
-        if (editorSave()) exit(0);
+    if (pending_len) filterAppendRow(&rows, &count, &capacity, pending, pending_len);
+    free(pending);
+    CloseHandle(child_out_read);
+    if (writer) {
+        WaitForSingleObject(writer, INFINITE);
+        CloseHandle(writer);
+    }
+    if (error_reader) {
+        WaitForSingleObject(error_reader, INFINITE);
+        CloseHandle(error_reader);
+    }
+    DWORD exit_code = 1;
+    WaitForSingleObject(pi.hProcess, INFINITE);
+    GetExitCodeProcess(pi.hProcess, &exit_code);
+    CloseHandle(pi.hProcess);
+    CloseHandle(pi.hThread);
+    if (exit_code != 0 || !writer) {
+        errors.text[strcspn(errors.text, "\r\n")] = '\0';
+        if (errors.text[0]) editorSetStatusMessage("Filter failed (%lu): %.60s", (unsigned long)exit_code, errors.text);
+        else editorSetStatusMessage("Filter failed (%lu)", (unsigned long)exit_code);
+        for (int j = 0; j < count; j++) editorFreeRow(&rows[j]);
+        free(rows);
+        return;
+    }
+    editorRemoveRows(job.start, job.end - job.start, NULL);
+    editorInsertRows(job.start, rows, count);
+    free(rows);
+    editorClearSelection();
+    E.file_position_y = job.start;
+    E.file_position_x = 0;
+    E.screen_dirty = 1;
+    editorSetStatusMessage("%d lines filtered into %d", job.end - job.start, count);
+}
+void editorToggleMacroRecording() {
+    if (macro.recording) {
+        macro.recording = 0;
+        macro.count--;
+        editorSetStatusMessage("Macro recorded (%d keys)", macro.count);
     } else {
-        exit(0);
+        macro.recording = 1;
+        macro.count = 0;
+        editorSetStatusMessage("Recording macro... F3 to stop");
+    }
+}
+void editorReplayMacro(int times) {
+    if (macro.recording || macro.replaying) return;
+    if (!macro.count) {
+        editorSetStatusMessage("No macro recorded");
+        return;
+    }
+    macro.replaying = 1;
+    int iterations = 0;
+    while (times < 0 ? E.file_position_y < E.number_of_rows : iterations < times) {
+        int remaining = E.number_of_rows - E.file_position_y;
+        macro.replay_position = 0;
+        while (macro.replay_position < macro.count)
+            editorProcessKey(editorReadKey());
+        iterations++;
+        if (times < 0 && E.number_of_rows - E.file_position_y >= remaining) break;
+    }
+    macro.replaying = 0;
+    editorFlushStaleRows();
+    editorSetStatusMessage("Macro replayed %d times", iterations);
+    E.screen_dirty = 1;
+}
+void editorReplayMacroPrompt() {
+    char *answer = editorPrompt("Replay macro (count, or 'e' for end of file): %s", NULL, NULL);
+    if (!answer) return;
+    int times = (answer[0] == 'e' || answer[0] == 'E') ? -1 : atoi(answer);
+    free(answer);
+    if (times == 0) {
+        editorSetStatusMessage("Invalid replay count");
+        return;
     }
+    editorReplayMacro(times);
 }
 void editorExecuteTerminalCommand() {
+    if (strcmp(E.terminal_input, "buffers") == 0) {
+        editorListBuffers();
+        goto reset;
+    }
+    if (strncmp(E.terminal_input, "buffer ", 7) == 0) {
+        int index = atoi(E.terminal_input + 7) - 1;
+        if (index < 0 || index >= buffers.count) editorSetStatusMessage("No such buffer");
+        else editorSwitchBuffer(index);
+        goto reset;
+    }
+    if (strcmp(E.terminal_input, "hex") == 0 || strncmp(E.terminal_input, "hex ", 4) == 0) {
+        editorHexView(E.terminal_input[3] ? E.terminal_input + 4 : E.filename);
+        goto reset;
+    }
+    if (strncmp(E.terminal_input, "gzip ", 5) == 0) {
+        editorSetGzip(E.terminal_input + 5);
+        goto reset;
+    }
+    if (strncmp(E.terminal_input, "filter ", 7) == 0) {
+        editorFilterRows(E.terminal_input + 7);
+        goto reset;
+    }
     if (strncmp(E.terminal_input, "run ", 4) != 0) {
         editorSetStatusMessage("Unknown command");
         goto reset;
@@ -789,9 +3820,12 @@ reset:
     E.terminal_input[0] = '\0';
     E.terminal_input_len = 0;
 }
-void editorProcessKeypress() {
-    int c = editorReadKey();
-    if (E.terminal_output_mode) {
+void editorProcessKey(int c) {
+    if (hex_view.active) {
+        editorHexViewProcessKey(c);
+    } else if (diff_view.active) {
+        editorDiffViewProcessKey(c);
+    } else if (E.terminal_output_mode) {
         switch (c) {
             case '\r':
             case CTRL_KEY('q'):
@@ -826,7 +3860,7 @@ void editorProcessKeypress() {
                 E.screen_dirty = 1;
                 break;
             default:
-                if (!iscntrl((unsigned char)c) && c < 128 && E.terminal_input_len < PROMPT_MAX_LENGTH - 1) {
+                if (!iscntrl((unsigned char)c) && c < 256 && E.terminal_input_len < PROMPT_MAX_LENGTH - 1) {
                     E.terminal_input[E.terminal_input_len++] = c;
                     E.terminal_input[E.terminal_input_len] = '\0';
                 }
@@ -834,7 +3868,17 @@ void editorProcessKeypress() {
                 break;
         }
     } else {
+        if (c != CTRL_KEY('n')) completion.active = 0;
         switch (c) {
+            case CTRL_KEY('n'):
+                editorComplete();
+                break;
+            case CTRL_KEY('k'):
+                editorToggleFold();
+                break;
+            case CTRL_KEY('t'):
+                editorFoldAll();
+                break;
             case CTRL_KEY('e'):
                 E.in_terminal_mode = 1;
                 E.terminal_input[0] = '\0';
@@ -843,6 +3887,7 @@ void editorProcessKeypress() {
                 E.screen_dirty = 1;
                 break;
             case '\r':
+                editorDeleteSelection();
                 if (E.file_position_y >= E.number_of_rows) {
                     if (E.number_of_rows == 0) {
                         editorInsertRow(0, "", 0);
@@ -869,6 +3914,7 @@ void editorProcessKeypress() {
                 E.screen_dirty = 1;
                 break;
             case HOME_KEY:
+                editorClearSelection();
                 E.file_position_x = 0;
                 int old_row_offset = E.row_offset;
                 int old_column_offset = E.column_offset;
@@ -880,6 +3926,7 @@ void editorProcessKeypress() {
                 }
                 break;
             case END_KEY:
+                editorClearSelection();
                 if (E.file_position_y < E.number_of_rows)
                     E.file_position_x = E.row[E.file_position_y].size;
                 old_row_offset = E.row_offset;
@@ -891,20 +3938,72 @@ void editorProcessKeypress() {
                     E.cursor_moved = 1;
                 }
                 break;
+            case CTRL_KEY('o'):
+                editorOpenBuffer();
+                E.screen_dirty = 1;
+                break;
+            case CTRL_KEY('b'):
+                editorSwitchBuffer((buffers.current + 1) % buffers.count);
+                break;
+            case CTRL_KEY('w'):
+                editorCloseBuffer();
+                E.screen_dirty = 1;
+                break;
+            case CTRL_KEY(']'):
+                editorJumpToMatchingBracket();
+                break;
+            case CTRL_KEY('d'):
+                editorDiff();
+                E.screen_dirty = 1;
+                break;
             case CTRL_KEY('f'):
                 editorFind();
                 E.screen_dirty = 1;
                 break;
             case BACKSPACE: case CTRL_KEY('h'):
-                editorDelChar();
+                if (!editorDeleteSelection()) editorDelChar();
                 E.screen_dirty = 1;
                 break;
             case DEL_KEY:
-                editorDelCharAtCursor();
+                if (!editorDeleteSelection()) editorDelCharAtCursor();
+                E.screen_dirty = 1;
+                break;
+            case CTRL_KEY('a'):
+                if (E.number_of_rows) {
+                    E.selection_active = 1;
+                    E.selection_anchor_x = E.selection_anchor_y = 0;
+                    E.file_position_y = E.number_of_rows - 1;
+                    E.file_position_x = E.row[E.file_position_y].size;
+                }
+                E.screen_dirty = 1;
+                break;
+            case CTRL_KEY('c'):
+                editorCopySelection();
+                break;
+            case CTRL_KEY('x'):
+                editorCutSelection();
+                E.screen_dirty = 1;
+                break;
+            case CTRL_KEY('v'):
+                editorPaste();
+                E.screen_dirty = 1;
+                break;
+            case SHIFT_ARROW_UP: case SHIFT_ARROW_DOWN: case SHIFT_ARROW_LEFT: case SHIFT_ARROW_RIGHT:
+                editorStartSelection();
+                editorMoveCursor(c == SHIFT_ARROW_UP ? ARROW_UP : c == SHIFT_ARROW_DOWN ? ARROW_DOWN : c == SHIFT_ARROW_LEFT ? ARROW_LEFT : ARROW_RIGHT);
+                E.screen_dirty = 1;
+                break;
+            case SHIFT_HOME_KEY: case SHIFT_END_KEY:
+                editorStartSelection();
+                if (c == SHIFT_HOME_KEY)
+                    E.file_position_x = 0;
+                else if (E.file_position_y < E.number_of_rows)
+                    E.file_position_x = E.row[E.file_position_y].size;
                 E.screen_dirty = 1;
                 break;
             case PAGE_UP: case PAGE_DOWN:
-                E.file_position_y = (c == PAGE_UP) ? E.row_offset : E.row_offset + E.screen_rows - 1;
+                editorClearSelection();
+                E.file_position_y = (c == PAGE_UP) ? E.row_offset : foldRowAtVisible(foldVisibleBefore(E.row_offset) + E.screen_rows - 1);
                 if (E.file_position_y > E.number_of_rows)
                     E.file_position_y = E.number_of_rows;
                 for (int i = E.screen_rows; i--; )
@@ -912,6 +4011,7 @@ void editorProcessKeypress() {
                 E.screen_dirty = 1;
                 break;
             case ARROW_UP: case ARROW_DOWN: case ARROW_LEFT: case ARROW_RIGHT:
+                editorClearSelection();
                 editorMoveCursor(c);
                 old_row_offset = E.row_offset;
                 old_column_offset = E.column_offset;
@@ -924,7 +4024,25 @@ void editorProcessKeypress() {
                 break;
             case CTRL_KEY('l'):
                 break;
+            case CTRL_KEY('p'):
+                perfToggleOverlay();
+                break;
+            case F3_KEY:
+                if (!macro.replaying) editorToggleMacroRecording();
+                break;
+            case F4_KEY:
+            case CTRL_KEY('r'):
+                if (macro.recording) {
+                    macro.count--;
+                    editorSetStatusMessage("Stop recording before replaying");
+                } else if (c == F4_KEY) {
+                    editorReplayMacro(1);
+                } else if (!macro.replaying) {
+                    editorReplayMacroPrompt();
+                }
+                break;
             default:
+                editorDeleteSelection();
                 if (E.file_position_y >= E.number_of_rows) {
                     for (int i = E.number_of_rows; i <= E.file_position_y; i++) {
                         editorInsertRow(i, "", 0);
@@ -935,11 +4053,20 @@ void editorProcessKeypress() {
                 break;
         }
     }
+    foldReveal(E.file_position_y);
+}
+void editorProcessKeypress() {
+    int c = editorReadKey();
+    LONGLONG start = perfBegin();
+    editorProcessKey(c);
+    perfEnd(PERF_KEY, start);
+    if (perf.enabled) perf.key_time = start;
 }
 void initEditor() {
     E.file_position_x = E.file_position_y = E.screen_position_x = E.row_offset = E.column_offset = 0;
-    E.number_of_rows = E.dirty = 0;
+    E.number_of_rows = E.row_capacity = E.dirty = 0;
     E.row = NULL;
+    E.selection_active = E.selection_anchor_x = E.selection_anchor_y = 0;
     E.filename = NULL;
     E.status_message[0] = '\0';
     E.status_message_time = 0;
@@ -952,14 +4079,40 @@ void initEditor() {
     E.terminal_history = NULL;
     E.terminal_history_num_lines = 0;
     E.terminal_height = 5;
+    buffers.capacity = 4;
+    buffers.items = safeMalloc(sizeof(struct editorConfig) * buffers.capacity);
+    buffers.count = 1;
+    buffers.current = 0;
     if (getWindowSize(&E.screen_rows, &E.screen_columns) == -1) die("getWindowSize");
     E.screen_rows = (E.screen_rows > 2) ? (E.screen_rows - 2) : 0;
 }
 int main(int argc, char *argv[]) {
     enableRawMode();
     initEditor();
-    if (argc >= 2) editorOpen(argv[1]);
-    editorSetStatusMessage("Ctrl-S = save | Ctrl-Q = quit | Ctrl-F = find");
+    int opened = 0;
+    char *hex_path = NULL;
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "-p") == 0 && i + 1 < argc) {
+            perf.dump_path = argv[++i];
+            perfEnable();
+            atexit(perfDump);
+            continue;
+        }
+        if (strcmp(argv[i], "-x") == 0 && i + 1 < argc) {
+            hex_path = argv[++i];
+            continue;
+        }
+        if (strcmp(argv[i], "-z") == 0 && i + 1 < argc) {
+            gzip_level = atoi(argv[++i]);
+            if (gzip_level < 0 || gzip_level > 9) gzip_level = 6;
+            continue;
+        }
+        if (opened++) editorNewBuffer();
+        editorOpen(argv[i]);
+    }
+    editorSwitchBuffer(0);
+    editorSetStatusMessage("Ctrl-S = save | Ctrl-Q = quit | Ctrl-F = find | Ctrl-C/X/V = copy/cut/paste");
+    if (hex_path) editorHexView(hex_path);
     while (1) {
         editorRefreshScreen();
         editorProcessKeypress();